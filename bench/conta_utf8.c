@@ -0,0 +1,67 @@
+// conta_utf8.c
+// ------------
+// mede a validação e contagem de utf8 (u8_conta_unichar_nos_bytes) em cada
+//   uma das versões escolhidas em tempo de execução: escalar, SSE4.2 e AVX2
+//   (as que a CPU não tiver são puladas)
+// cada versão percorre 3 vezes um buffer de 64MiB com texto ASCII, latino
+//   (acentos de 2 bytes) e CJK com emojis (3 e 4 bytes)
+//
+// uso (no diretório principal):
+//   gcc -std=gnu11 -O2 bench/conta_utf8.c -o /tmp/conta_utf8 && /tmp/conta_utf8
+
+// as versões são static em utf8.c
+#include "../utf8.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define TAM_BUFFER (64 << 20)
+#define REPETICOES 3
+
+static double agora(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// preenche um buffer com cópias de pedaco, e mede cada versão nele
+static void mede(char *nome, char *pedaco)
+{
+  byte *buf = malloc(TAM_BUFFER);
+  assert(buf != NULL);
+  int tam_pedaco = strlen(pedaco);
+  int nbytes = 0;
+  while (nbytes + tam_pedaco <= TAM_BUFFER) {
+    memcpy(buf + nbytes, pedaco, tam_pedaco);
+    nbytes += tam_pedaco;
+  }
+  __builtin_cpu_init();
+  struct {
+    char *nome;
+    bool disponivel;
+    int (*conta)(byte *ptr, int nbytes);
+  } versoes[] = {
+    { "escalar", true, u8_conta_escalar },
+    { "sse4.2", __builtin_cpu_supports("sse4.2"), u8_conta_sse },
+    { "avx2", __builtin_cpu_supports("avx2"), u8_conta_avx2 },
+  };
+  for (int v = 0; v < 3; v++) {
+    if (!versoes[v].disponivel) continue;
+    int nchars = 0;
+    double t = agora();
+    for (int i = 0; i < REPETICOES; i++) nchars = versoes[v].conta(buf, nbytes);
+    t = agora() - t;
+    printf("%-6s %-8s %6.2f GB/s (%d caracteres)\n", nome, versoes[v].nome,
+           (double)REPETICOES * nbytes / t / 1e9, nchars);
+  }
+  free(buf);
+}
+
+int main(void)
+{
+  mede("ascii", "int main(void) { return 0; }\n");
+  mede("latino", "ação é pública; ");
+  mede("cjk", "日本語のテキスト😀🎉");
+  return 0;
+}
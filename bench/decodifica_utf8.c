@@ -0,0 +1,129 @@
+// decodifica_utf8.c
+// -----------------
+// mede a decodificação de utf8 com o autômato (u8_unichar_nos_bytes e a
+//   contagem escalar, que percorre o buffer todo sem chamadas por caractere)
+//   e com o decodificador com desvios que o autômato substituiu, copiado
+//   abaixo para comparação
+// o texto é misto: português, CJK e emojis, em um buffer de 64MiB
+//
+// uso (no diretório principal):
+//   gcc -std=gnu11 -O2 bench/decodifica_utf8.c -o /tmp/decodifica_utf8 && /tmp/decodifica_utf8
+
+// a contagem escalar é static em utf8.c
+#include "../utf8.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define TAM_BUFFER (64 << 20)
+#define REPETICOES 3
+
+static double agora(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// o decodificador anterior ao autômato {{{1
+
+static bool soma_bits_de_continuacao(unichar *uni, byte cont)
+{
+  if (!u8_byte_de_continuacao(cont)) return false;
+  byte bits = cont & 0b00111111;
+  *uni = ((*uni) << 6) | bits;
+  return true;
+}
+
+static int decodifica_com_desvios(byte *s, int maxn, unichar *puni)
+{
+  byte primeiro_byte = s[0];
+  int nbytes = u8_bytes_no_unichar_que_comeca_com(primeiro_byte);
+  if (nbytes < 1 || nbytes > maxn || nbytes > 4) return -1;
+
+  byte mascara[] = { 0b01111111, 0b00011111, 0b00001111, 0b00000111, };
+  unichar uni = primeiro_byte & mascara[nbytes - 1];
+  int nbytes_adicionados = 1;
+  while (nbytes > nbytes_adicionados) {
+    if (!soma_bits_de_continuacao(&uni, s[nbytes_adicionados])) return -1;
+    nbytes_adicionados++;
+  }
+
+  if (nbytes > 1 && uni < 0x80) return -1;
+  if (nbytes > 2 && uni < 0x800) return -1;
+  if (nbytes > 3 && uni < 0x10000) return -1;
+  if (!u8_unichar_valido(uni)) return -1;
+
+  if (puni != NULL) *puni = uni;
+  return nbytes;
+}
+
+// medidas {{{1
+
+// decodifica todos os caracteres do buffer, um por chamada; retorna a soma
+//   dos códigos, para que o trabalho não seja descartado pelo compilador
+static unichar decodifica_tudo(byte *ptr, int nbytes,
+                               int (*decodifica)(byte *s, int maxn, unichar *puni))
+{
+  unichar soma = 0;
+  while (nbytes > 0) {
+    unichar uni;
+    int nb1 = decodifica(ptr, nbytes, &uni);
+    if (nb1 < 1) return 0;
+    soma += uni;
+    ptr += nb1;
+    nbytes -= nb1;
+  }
+  return soma;
+}
+
+// a contagem com verificação como era feita antes do autômato
+static int conta_com_desvios(byte *ptr, int nbytes)
+{
+  int num_uni = 0;
+  while (nbytes > 0) {
+    int nb1 = decodifica_com_desvios(ptr, nbytes, NULL);
+    if (nb1 < 1) return -1;
+    num_uni++;
+    ptr += nb1;
+    nbytes -= nb1;
+  }
+  return num_uni;
+}
+
+static void imprime(char *nome, double t, int nbytes, unsigned resultado)
+{
+  printf("%-20s %6.2f GB/s (%u)\n", nome, (double)REPETICOES * nbytes / t / 1e9,
+         resultado);
+}
+
+int main(void)
+{
+  char *pedaco = "Não há ação sem reação; 日本語のテキスト 😀 fim.\n";
+  byte *buf = malloc(TAM_BUFFER);
+  assert(buf != NULL);
+  int tam_pedaco = strlen(pedaco);
+  int nbytes = 0;
+  while (nbytes + tam_pedaco <= TAM_BUFFER) {
+    memcpy(buf + nbytes, pedaco, tam_pedaco);
+    nbytes += tam_pedaco;
+  }
+
+  unsigned r = 0;
+  double t = agora();
+  for (int i = 0; i < REPETICOES; i++) r = decodifica_tudo(buf, nbytes, decodifica_com_desvios);
+  imprime("decodifica, desvios", agora() - t, nbytes, r);
+  t = agora();
+  for (int i = 0; i < REPETICOES; i++) r = decodifica_tudo(buf, nbytes, u8_unichar_nos_bytes);
+  imprime("decodifica, tabela", agora() - t, nbytes, r);
+  t = agora();
+  for (int i = 0; i < REPETICOES; i++) r = conta_com_desvios(buf, nbytes);
+  imprime("conta, desvios", agora() - t, nbytes, r);
+  t = agora();
+  for (int i = 0; i < REPETICOES; i++) r = u8_conta_escalar(buf, nbytes);
+  imprime("conta, tabela", agora() - t, nbytes, r);
+
+  free(buf);
+  return 0;
+}
+// vim: foldmethod=marker shiftwidth=2
@@ -0,0 +1,61 @@
+// str_ascii.c
+// -----------
+// mede as operações de str que acessam caracteres pela posição (s_ch,
+//   s_sub, buscas, inserção e remoção) em linhas só com ASCII, que usam o
+//   caminho rápido (a posição de um caractere é a do seu byte), e em linhas
+//   com alguns caracteres acentuados, que percorrem o utf8
+// as linhas têm 80 caracteres, como linhas de código fonte
+//
+// uso (no diretório principal):
+//   gcc -std=gnu11 -O2 -I. bench/str_ascii.c str.c utf8.c lstr.c -o /tmp/str_ascii && /tmp/str_ascii
+
+#include "str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NLINHAS 20000
+#define REPETICOES 20
+
+static double agora(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// faz NLINHAS cópias de linha, e mede uma mistura de operações em cada uma
+static void mede(char *nome, char *linha)
+{
+  str *linhas = malloc(NLINHAS * sizeof(str));
+  for (int i = 0; i < NLINHAS; i++) linhas[i] = s_copia(s_cria(linha));
+  // soma resultados, para que o trabalho não seja descartado pelo compilador
+  unsigned long long soma = 0;
+  srand(1);
+  double t = agora();
+  for (int r = 0; r < REPETICOES; r++) {
+    for (int i = 0; i < NLINHAS; i++) {
+      int n = s_tam(linhas[i]);
+      soma += s_ch(linhas[i], rand() % n);
+      soma += s_sub(linhas[i], n / 3, n / 3).tamb;
+      soma += s_busca_c(linhas[i], 0, s_(";"));
+      soma += s_busca_rc(linhas[i], -1, s_("("));
+      soma += s_busca_s(linhas[i], 0, s_("return"));
+      s_insere(&linhas[i], n / 2, s_("x"));
+      s_remove(&linhas[i], n / 2, 1);
+    }
+  }
+  t = agora() - t;
+  printf("%-6s %7.1f ns por linha (%llu)\n", nome, t * 1e9 / (REPETICOES * NLINHAS),
+         soma % 10);
+  for (int i = 0; i < NLINHAS; i++) s_destroi(linhas[i]);
+  free(linhas);
+}
+
+int main(void)
+{
+  mede("ascii", "    for (int i = 0; i < cad.tamc; i++) { if (x(cad, i)) return count(i); } // fim;");
+  mede("misto", "    para (int í = 0; í < cad.tamc; í++) { se (x(cad, í)) return conta(í); } // fim;");
+  return 0;
+}
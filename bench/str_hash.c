@@ -0,0 +1,98 @@
+// str_hash.c
+// ----------
+// mede s_hash e s_compara em linhas de vários tamanhos, comparando com um
+//   hash FNV-1a (um byte por vez) e com uma comparação caractere a
+//   caractere feita com s_ch
+// para cada tamanho, as linhas somam 256MiB (no máximo 4 milhões de linhas);
+//   s_compara compara cada linha com ela mesma, o pior caso (percorre até o
+//   último byte)
+//
+// uso (no diretório principal):
+//   gcc -std=gnu11 -O2 -I. bench/str_hash.c str.c utf8.c lstr.c -o /tmp/str_hash && /tmp/str_hash
+
+#include "str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TOTAL_BYTES (256L << 20)
+#define MAX_LINHAS 4000000
+
+static double agora(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t fnv1a(str cad)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (int i = 0; i < cad.tamb; i++) {
+    h ^= cad.mem[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static int compara_com_s_ch(str a, str b)
+{
+  int ta = s_tam(a);
+  int tb = s_tam(b);
+  int n = ta < tb ? ta : tb;
+  for (int i = 0; i < n; i++) {
+    unichar ca = s_ch(a, i);
+    unichar cb = s_ch(b, i);
+    if (ca != cb) return ca < cb ? -1 : 1;
+  }
+  return ta < tb ? -1 : ta > tb;
+}
+
+static void mede(int tam_linha)
+{
+  int n = TOTAL_BYTES / tam_linha;
+  if (n > MAX_LINHAS) n = MAX_LINHAS;
+  long nbytes = (long)n * tam_linha;
+  char *buf = malloc(nbytes);
+  str *linhas = malloc(n * sizeof(str));
+  for (long i = 0; i < nbytes; i++) buf[i] = 'a' + (i * 7) % 26;
+  for (int i = 0; i < n; i++) {
+    linhas[i] = s_cria_buf((byte *)buf + (long)i * tam_linha, tam_linha, tam_linha);
+  }
+  // soma resultados, para que o trabalho não seja descartado pelo compilador
+  volatile uint64_t soma = 0;
+
+  double t = agora();
+  for (int i = 0; i < n; i++) soma += s_hash(linhas[i], 1);
+  double t_hash = agora() - t;
+
+  t = agora();
+  for (int i = 0; i < n; i++) soma += fnv1a(linhas[i]);
+  double t_fnv = agora() - t;
+
+  t = agora();
+  for (int i = 0; i < n; i++) soma += s_compara(linhas[i], linhas[i]);
+  double t_compara = agora() - t;
+
+  // a comparação com s_ch é bem mais lenta; é medida em parte das linhas
+  int m = n < 20000 ? n : 20000;
+  t = agora();
+  for (int i = 0; i < m; i++) soma += compara_com_s_ch(linhas[i], linhas[i]);
+  double t_s_ch = (agora() - t) / m * n;
+
+  double gb = nbytes / 1e9;
+  printf("%7d  %6.2f GB/s %6.1f ns  %6.2f GB/s  %6.2f GB/s %6.1f ns  %6.3f GB/s\n",
+         tam_linha, gb / t_hash, t_hash / n * 1e9, gb / t_fnv,
+         gb / t_compara, t_compara / n * 1e9, gb / t_s_ch);
+  free(linhas);
+  free(buf);
+}
+
+int main(void)
+{
+  printf("tamanho  %-21s  %-11s  %-21s  %s\n", "s_hash", "fnv1a", "s_compara", "s_ch");
+  int tamanhos[] = { 8, 16, 40, 80, 256, 4096 };
+  for (int i = 0; i < 6; i++) mede(tamanhos[i]);
+  return 0;
+}
@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
 
 #include "tela.h"
 #include "str.h"
 #include "lstr.h"
+#include "rope.h"
 
 // tipos e funções auxiliares {{{1
 
@@ -27,15 +30,6 @@ str s_uni(byte *buf, unichar uni)
   return s_cria_buf(buf, nbytes, 1);
 }
 
-// troca as strings em lista por cópias alteráveis
-void faz_lista_ter_copias_das_strings(Lstr lista)
-{
-  for (ls_inicio(lista); ls_avanca(lista); ) {
-    str *pcad = ls_item_ptr(lista);
-    *pcad = s_copia(*pcad);
-  }
-}
-
 // tipo para representar uma posição no texto ou na tela
 typedef struct {
   int lin;
@@ -85,20 +79,40 @@ static posicao_t pos_depois(posicao_t a, posicao_t b)
 // o conteúdo de um arquivo, como uma lista contendo suas linhas
 typedef struct {
   Lstr linhas;
+  s_arena *arena; // memória dos nós da lista de linhas
+  str conteudo;   // conteúdo do arquivo, referenciado pelas linhas
   str nome_arquivo;
+  s_formato_t formato; // codificação e finais de linha originais do arquivo
   // bool alterado;
 } texto_t;
 
 // aloca e inicializa um texto à partir de um arquivo
-texto_t *texto_cria(str nome_arquivo)
+// se o arquivo não existir, o texto é vazio; se existir e não puder ser
+//   lido, retorna NULL, com errno indicando o erro
+// se normaliza for true, o conteúdo é convertido para a forma NFC (acentos
+//   pré-compostos), para que as buscas encontrem o texto independentemente
+//   da forma usada pelo programa que gerou o arquivo
+texto_t *texto_cria(str nome_arquivo, bool normaliza)
 {
+  // as linhas não são copiadas: referenciam o arquivo mapeado (ou a cópia
+  //   dele, se precisar ser convertido ou normalizado) até serem alteradas
+  //   (ver texto_linha_alteravel)
+  s_formato_t formato;
+  str conteudo = s_mapeia_arquivo_formato(nome_arquivo, &formato);
+  if (s_mem(conteudo) == NULL && errno != ENOENT) return NULL;
+  if (normaliza && u8_prefixo_nfc((byte *)s_mem(conteudo), conteudo.tamb) != conteudo.tamb) {
+    str copia = s_copia(conteudo);
+    s_desmapeia(conteudo);
+    s_normaliza(&copia);
+    conteudo = copia;
+  }
   texto_t *txt = malloc(sizeof(*txt));
   assert(txt != NULL);
   txt->nome_arquivo = s_copia(nome_arquivo);
-  str conteudo = s_le_arquivo(nome_arquivo);
-  txt->linhas = s_separa(conteudo, s_("\n"));
-  faz_lista_ter_copias_das_strings(txt->linhas);
-  s_destroi(conteudo);
+  txt->formato = formato;
+  txt->conteudo = conteudo;
+  txt->arena = s_arena_cria();
+  txt->linhas = s_separa_sem_copia(conteudo, s_("\n"), txt->arena);
   return txt;
 }
 
@@ -106,9 +120,23 @@ void texto_destroi(texto_t *txt)
 {
   s_destroi(txt->nome_arquivo);
   ls_destroi(txt->linhas);
+  s_arena_destroi(txt->arena);
+  // nenhuma linha referencia mais o conteúdo
+  s_desmapeia(txt->conteudo);
   free(txt);
 }
 
+// retorna um ponteiro para a linha na posição corrente da lista de linhas,
+//   para ser alterada
+// uma linha que ainda referencia o conteúdo do arquivo (não é alterável) é
+//   antes trocada por uma cópia
+str *texto_linha_alteravel(texto_t *txt)
+{
+  str *plinha = ls_item_ptr(txt->linhas);
+  if (plinha->cap == 0) *plinha = s_copia(*plinha);
+  return plinha;
+}
+
 // janela_t {{{1
 
 // estrutura que contém os dados sobre uma janela
@@ -126,6 +154,10 @@ typedef struct {
   posicao_t inicio_txt;  // que posição do texto está no início da janela
   posicao_t cursor_txt;  // em que posição do texto está o cursor
   posicao_t ancora;      // a seleção é entre a âncora e o cursor
+  int lin_edicao;        // linha em edição, fora da lista (ou -1), ver jan_edita_linha
+  s_lacuna *lacuna;      // a linha em edição, se for curta (ou NULL)
+  Rope rope;             // a linha em edição, se for longa (ou NULL)
+  str trecho;            // cópia de parte da linha em rope, ver jan_trecho
   // bool visivel;
 } janela_t;
 
@@ -154,16 +186,131 @@ janela_t *jan_cria(texto_t *txt)
   jan->inicio_txt = (posicao_t){0,0};
   jan->inicio_tela = (posicao_t){1,1};
   jan->tamanho = (tamanho_t){tela_nlin(), tela_ncol()};
+  jan->lin_edicao = -1;
+  jan->lacuna = NULL;
+  jan->rope = NULL;
+  jan->trecho = s_("");
   return jan;
 }
 
+static void jan_descarrega_linha(janela_t *jan);
+
 void jan_destroi(janela_t *jan)
 {
+  jan_descarrega_linha(jan);
+  s_destroi(jan->trecho);
   free(jan);
 }
 
+// linha em edição
+
+// a linha do cursor sai da lista quando é alterada caractere a caractere
+//   (ou quando começa o modo de inserção ou de troca), e passa para uma
+//   string com lacuna, para que cada tecla só mude os limites da lacuna em
+//   vez de mover o restante da linha; uma linha com pelo menos LIMITE_ROPE
+//   bytes vai para uma rope, onde nem mudar a lacuna de lugar custaria o
+//   tamanho da linha
+// enquanto está em edição, a linha fica vazia na lista; ela volta para a
+//   lista quando o cursor sai dela, ou antes de qualquer operação que precise
+//   da lista (as que passam por jan_posiciona_lista ou jan_linha_corrente)
+// o desenho, a posição do cursor e os movimentos de palavra leem a linha com
+//   jan_trecho e jan_tam_linha, que sabem da linha em edição
+#define LIMITE_ROPE (64 * 1024)
+
+// devolve para a lista a linha em edição, se houver
+static void jan_descarrega_linha(janela_t *jan)
+{
+  if (jan->lin_edicao < 0) return;
+  Lstr linhas = jan->txt->linhas;
+  ls_posiciona(linhas, jan->lin_edicao);
+  str *plinha = ls_item_ptr(linhas);
+  s_destroi(*plinha);
+  if (jan->rope != NULL) {
+    *plinha = rp_para_str(jan->rope);
+    jan->rope = NULL;
+  } else {
+    *plinha = s_lacuna_fecha(jan->lacuna);
+    jan->lacuna = NULL;
+  }
+  jan->lin_edicao = -1;
+}
+
+// põe a linha do cursor em edição, se já não estiver
+// se o texto estiver vazio, cria uma linha; se o cursor estiver fora do
+//   texto, vai para a linha mais próxima
+static void jan_edita_linha(janela_t *jan)
+{
+  Lstr linhas = jan->txt->linhas;
+  if (ls_tam(linhas) == 0) ls_insere_antes(linhas, s_(""));
+  jan->cursor_txt.lin = menor(maior(jan->cursor_txt.lin, 0), ls_tam(linhas) - 1);
+  if (jan->lin_edicao == jan->cursor_txt.lin) return;
+  jan_descarrega_linha(jan);
+  ls_posiciona(linhas, jan->cursor_txt.lin);
+  str *plinha = ls_item_ptr(linhas);
+  if (plinha->tamb < LIMITE_ROPE) {
+    jan->lacuna = s_lacuna_cria(*plinha);
+  } else {
+    jan->rope = rp_de_str(*plinha);
+  }
+  *plinha = s_copia(s_(""));
+  jan->lin_edicao = jan->cursor_txt.lin;
+}
+
+// substitui tam caracteres a partir da coluna col da linha do cursor
+//   por cad, com a linha em edição
+static void jan_altera_linha(janela_t *jan, int col, int tam, str cad)
+{
+  jan_edita_linha(jan);
+  if (jan->rope != NULL) {
+    rp_remove(jan->rope, col, tam);
+    rp_insere(jan->rope, col, cad);
+  } else {
+    s_lacuna_remove(jan->lacuna, col, tam);
+    s_lacuna_insere(jan->lacuna, col, cad);
+  }
+}
+
+// retorna o número de caracteres da linha lin, que deve existir
+static int jan_tam_linha(janela_t *jan, int lin)
+{
+  if (lin == jan->lin_edicao) {
+    if (jan->rope != NULL) return rp_tam(jan->rope);
+    return s_lacuna_tam(jan->lacuna);
+  }
+  Lstr linhas = jan->txt->linhas;
+  ls_posiciona(linhas, lin);
+  return s_tam(ls_item(linhas));
+}
+
+// retorna até n caracteres da linha lin (que deve existir), a partir da
+//   coluna col
+// se a linha estiver em edição, o trecho só vale até a próxima chamada (se
+//   a linha estiver na rope, é uma cópia)
+static str jan_trecho(janela_t *jan, int lin, int col, int n)
+{
+  if (lin == jan->lin_edicao) {
+    if (jan->lacuna != NULL) return s_lacuna_sub(jan->lacuna, col, n);
+    s_destroi(jan->trecho);
+    jan->trecho = rp_sub(jan->rope, col, n);
+    return jan->trecho;
+  }
+  Lstr linhas = jan->txt->linhas;
+  ls_posiciona(linhas, lin);
+  return s_sub(ls_item(linhas), col, n);
+}
+
 // desenho do texto na janela
 
+// as funções de desenho de uma linha recebem em resto a parte da linha a
+//   partir da coluna inicial da janela
+
+// retorna quantos caracteres de resto cabem na largura da janela (caracteres
+//   largos ocupam 2 colunas da tela)
+static int jan_nchars_visiveis(janela_t *jan, str resto)
+{
+  return s_tam_na_largura(resto, jan->tamanho.larg - 6);
+}
+
 // mostra o número da linha, à esquerda do conteúdo da linha
 void jan_desenha_numero_da_linha(int num_linha, bool selecionada)
 {
@@ -175,7 +322,7 @@ void jan_desenha_numero_da_linha(int num_linha, bool selecionada)
 
 // desenha uma linha, ressaltando os linhas que fazem parte da seleção, quando
 //   a seleção está no modo linha
-static void jan_desenha_linha_selecao_linha(janela_t *jan, int num_linha, str linha)
+static void jan_desenha_linha_selecao_linha(janela_t *jan, int num_linha, str resto)
 {
   int lin_ini = menor(jan->cursor_txt.lin, jan->ancora.lin);
   int lin_fim = maior(jan->cursor_txt.lin, jan->ancora.lin);
@@ -184,29 +331,28 @@ static void jan_desenha_linha_selecao_linha(janela_t *jan, int num_linha, str li
   } else {
     jan_cor(cor_texto_sel);
   }
-  str visivel = s_sub(linha, jan->inicio_txt.col, jan->tamanho.larg - 6);
+  str visivel = s_sub(resto, 0, jan_nchars_visiveis(jan, resto));
   s_imprime(visivel);
   tela_limpa_fim_da_linha();
 }
 
 // desenha uma linha quando está em modo seleção caractere
-static void jan_desenha_linha_selecao_caractere(janela_t *jan, int num_linha, str linha)
+static void jan_desenha_linha_selecao_caractere(janela_t *jan, int num_linha, str resto)
 {
   // se não é uma linha onde tem uma mudança de seleção, desenha igual a sel_lin
   if (num_linha != jan->cursor_txt.lin && num_linha != jan->ancora.lin) {
-    return jan_desenha_linha_selecao_linha(jan, num_linha, linha);
+    return jan_desenha_linha_selecao_linha(jan, num_linha, resto);
   }
   posicao_t pos_ini = pos_antes(jan->cursor_txt, jan->ancora);
   posicao_t pos_fim = pos_depois(jan->cursor_txt, jan->ancora);
-  int larg = jan->tamanho.larg - 6;
-  // colunas: i-início da linha  f-fim da linha
+  // colunas: i-início da parte visível  f-primeira após a parte visível
   // cor normal entre i e ts, selecionado entre ts e st, normal entre st e f
   int col_i = jan->inicio_txt.col;
-  int col_f = menor(s_tam(linha), larg - 1);
+  int col_f = col_i + jan_nchars_visiveis(jan, resto);
   int col_ts = col_i;
-  int col_st = col_f;
+  int col_st = col_f - 1;
   if (num_linha == pos_ini.lin) {
-    col_ts = maior(col_ts, pos_ini.col);
+    col_ts = menor(maior(col_ts, pos_ini.col), col_f);
   }
   if (num_linha == pos_fim.lin) {
     col_st = menor(pos_fim.col, col_st);
@@ -214,32 +360,33 @@ static void jan_desenha_linha_selecao_caractere(janela_t *jan, int num_linha, st
   // texto normal antes
   if (col_i < col_ts) {
     jan_cor(cor_texto);
-    s_imprime(s_sub(linha, col_i, col_ts - col_i));
+    s_imprime(s_sub(resto, 0, col_ts - col_i));
   }
   // texto na selecao
   if (col_ts <= col_st) {
     jan_cor(cor_texto_sel);
-    s_imprime(s_sub(linha, col_ts, col_st - col_ts + 1));
+    s_imprime(s_sub(resto, col_ts - col_i, col_st - col_ts + 1));
   }
   // texto normal depois
-  if (col_st < col_f) {
+  int col_depois = maior(col_st + 1, col_ts);
+  if (col_depois < col_f) {
     jan_cor(cor_texto);
-    s_imprime(s_sub(linha, col_st + 1, col_f - col_st));
+    s_imprime(s_sub(resto, col_depois - col_i, col_f - col_depois));
   }
   tela_limpa_fim_da_linha();
 }
 
 // desenha a linha num_linha do texto na janela, no modo modo
-static void jan_desenha_linha(janela_t *jan, int num_linha, str linha, modo_t modo)
+static void jan_desenha_linha(janela_t *jan, int num_linha, str resto, modo_t modo)
 {
   jan_desenha_numero_da_linha(num_linha, num_linha == jan->cursor_txt.lin);
   if (modo == selecao_caractere) {
-    return jan_desenha_linha_selecao_caractere(jan, num_linha, linha);
+    return jan_desenha_linha_selecao_caractere(jan, num_linha, resto);
   } else if (modo == selecao_linha) {
-    return jan_desenha_linha_selecao_linha(jan, num_linha, linha);
+    return jan_desenha_linha_selecao_linha(jan, num_linha, resto);
   }
   jan_cor(cor_texto);
-  str visivel = s_sub(linha, jan->inicio_txt.col, jan->tamanho.larg - 6);
+  str visivel = s_sub(resto, 0, jan_nchars_visiveis(jan, resto));
   s_imprime(visivel);
   tela_limpa_fim_da_linha();
 }
@@ -254,8 +401,11 @@ void jan_desenha(janela_t *jan, modo_t modo)
     int num_linha = i + jan->inicio_txt.lin;
     ls_posiciona(linhas, num_linha);
     if (ls_item_valido(linhas)) {
-      str linha = ls_item(linhas);
-      jan_desenha_linha(jan, num_linha, linha, modo);
+      // não precisa mais que isso da linha (com folga para caracteres que
+      //   não ocupam coluna na tela)
+      int n = 4 * jan->tamanho.larg;
+      str resto = jan_trecho(jan, num_linha, jan->inicio_txt.col, n);
+      jan_desenha_linha(jan, num_linha, resto, modo);
     } else {
       // tá fora do texto
       jan_cor(cor_externa);
@@ -278,16 +428,24 @@ void jan_desenha(janela_t *jan, modo_t modo)
   printf(" %s | %d:%d | ", str_modo, jan->cursor_txt.lin + 1, jan->cursor_txt.col + 1);
   s_imprime(jan->txt->nome_arquivo);
   tela_limpa_fim_da_linha();
-  // posiciona o cursor
+  // posiciona o cursor, na coluna da tela após os caracteres que estão
+  //   antes dele na parte visível da linha
+  int col_tela = 0;
+  ls_posiciona(linhas, jan->cursor_txt.lin);
+  if (ls_item_valido(linhas)) {
+    int ncols = jan->cursor_txt.col - jan->inicio_txt.col;
+    col_tela = s_largura(jan_trecho(jan, jan->cursor_txt.lin, jan->inicio_txt.col, ncols));
+  }
   tela_lincol(jan->inicio_tela.lin + (jan->cursor_txt.lin - jan->inicio_txt.lin),
-              jan->inicio_tela.col + (jan->cursor_txt.col - jan->inicio_txt.col) + 6);
+              jan->inicio_tela.col + col_tela + 6);
 }
 
 // retorna a string na linha onde está o cursor
 str jan_linha_corrente(janela_t *jan)
 {
+  jan_descarrega_linha(jan);
   Lstr linhas = jan->txt->linhas;
-  if (ls_tam(linhas) == 0) ls_insere_antes(linhas, s_copia(s_("")));
+  if (ls_tam(linhas) == 0) ls_insere_antes(linhas, s_(""));
   ls_posiciona(linhas, jan->cursor_txt.lin);
   return ls_item(linhas);
 }
@@ -319,8 +477,8 @@ void jan_cursor_direita(janela_t *jan)
 // move o cursor para a última posição da linha
 void jan_cursor_final_linha(janela_t *jan)
 {
-  str lin = jan_linha_corrente(jan);
-  jan->cursor_txt.col = s_tam(lin);
+  if (ls_vazia(jan->txt->linhas)) jan_linha_corrente(jan); // cria a linha
+  jan->cursor_txt.col = jan_tam_linha(jan, jan->cursor_txt.lin);
 }
 
 // move o cursor para a última linha do texto
@@ -354,57 +512,100 @@ void jan_cursor_pg_baixo(janela_t *jan)
   jan->cursor_txt.lin += jan->tamanho.alt * 3 / 4;
 }
 
-// considerando palavra como qualquer coisa separada por espaços
-// move o cursor para o início da próxima palavra (o primeiro caractere
-// não espaço após um espaço)
-void jan_cursor_inicio_palavra_direita(janela_t *jan)
+// os movimentos de palavra leem a linha aos pedaços, com jan_trecho, para
+//   que a linha em edição não tenha que voltar para a lista (o que, em uma
+//   rope, custaria o tamanho da linha a cada movimento); o pedaço começa com
+//   TAM_TRECHO_PALAVRA caracteres, e dobra enquanto a palavra não terminar
+//   dentro dele
+#define TAM_TRECHO_PALAVRA 128
+
+// retorna true se o caractere na coluna col da linha lin é um espaço
+static bool jan_espaco_em(janela_t *jan, int lin, int col)
 {
-  str lin = jan_linha_corrente(jan);
-  int pos = s_busca_c(lin, jan->cursor_txt.col, s_(" "));
-  if (pos == -1) {
-    if (jan->cursor_txt.lin >= ls_tam(jan->txt->linhas)) return;
-    jan->cursor_txt.lin++;
-    lin = jan_linha_corrente(jan); 
+  if (col < 0 || col >= jan_tam_linha(jan, lin)) return false;
+  return u8_classe(s_ch(jan_trecho(jan, lin, col, 1), 0)) == u8_espaco;
+}
+
+// como s_fim_classe, na linha lin
+static int jan_fim_classe(janela_t *jan, int lin, int col, bool grande)
+{
+  int tam = jan_tam_linha(jan, lin);
+  for (int n = TAM_TRECHO_PALAVRA; ; n *= 2) {
+    str trecho = jan_trecho(jan, lin, col, n);
+    int fim = s_fim_classe(trecho, 0, grande);
+    if (fim < s_tam(trecho) || col + s_tam(trecho) >= tam) return col + fim;
+  }
+}
+
+// como s_inicio_classe, na linha lin
+static int jan_inicio_classe(janela_t *jan, int lin, int col, bool grande)
+{
+  col = menor(col, jan_tam_linha(jan, lin));
+  for (int n = TAM_TRECHO_PALAVRA; ; n *= 2) {
+    int ini = maior(col - n, 0);
+    str trecho = jan_trecho(jan, lin, ini, col - ini);
+    int inicio = s_inicio_classe(trecho, s_tam(trecho), grande);
+    if (inicio > 0 || ini == 0) return ini + inicio;
+  }
+}
+
+// uma palavra é uma sequência de caracteres da mesma classe (letras,
+//   pontuação, ideogramas -- ver u8_classe); uma palavra grande é qualquer
+//   coisa separada por espaços (se grande for true)
+// move o cursor para o início da próxima palavra
+void jan_cursor_inicio_palavra_direita(janela_t *jan, bool grande)
+{
+  if (ls_vazia(jan->txt->linhas)) return;
+  int lin = jan->cursor_txt.lin;
+  int pos = jan->cursor_txt.col;
+  if (pos < jan_tam_linha(jan, lin) && !jan_espaco_em(jan, lin, pos)) {
+    pos = jan_fim_classe(jan, lin, pos, grande);
+  }
+  if (jan_espaco_em(jan, lin, pos)) pos = jan_fim_classe(jan, lin, pos, grande);
+  // só espaços até o final: a próxima palavra é a primeira da linha seguinte
+  //   (na última linha, o cursor vai para o final)
+  if (pos >= jan_tam_linha(jan, lin) && lin < ls_tam(jan->txt->linhas) - 1) {
+    lin++;
     pos = 0;
+    if (jan_espaco_em(jan, lin, pos)) pos = jan_fim_classe(jan, lin, pos, grande);
   }
-  pos = s_busca_nc(lin, pos, s_(" "));
+  jan->cursor_txt.lin = lin;
   jan->cursor_txt.col = pos;
 }
 
 // move o cursor para o início anterior de uma palavra
-// (o primeiro caractere não espaço após um espaço, em uma posição anterior)
-void jan_cursor_inicio_palavra_esquerda(janela_t *jan)
+void jan_cursor_inicio_palavra_esquerda(janela_t *jan, bool grande)
 {
-  str lin = jan_linha_corrente(jan);
-  int pos = jan->cursor_txt.col - 1;
-  if (pos != -1) pos = s_busca_rnc(lin, pos, s_(" "));
-  if (pos == -1) {
-    if (jan->cursor_txt.lin == 0) return;
-    jan->cursor_txt.lin--;
-    lin = jan_linha_corrente(jan); 
-    pos = s_busca_rnc(lin, s_tam(lin), s_(" "));
+  if (ls_vazia(jan->txt->linhas)) return;
+  int lin = jan->cursor_txt.lin;
+  int pos = menor(jan->cursor_txt.col, jan_tam_linha(jan, lin));
+  if (jan_espaco_em(jan, lin, pos - 1)) pos = jan_inicio_classe(jan, lin, pos, grande);
+  if (pos == 0) {
+    if (lin == 0) return;
+    lin--;
+    pos = jan_tam_linha(jan, lin);
+    if (jan_espaco_em(jan, lin, pos - 1)) pos = jan_inicio_classe(jan, lin, pos, grande);
   }
-  pos = s_busca_rc(lin, pos, s_(" "));
-  jan->cursor_txt.col = pos + 1;
+  jan->cursor_txt.lin = lin;
+  jan->cursor_txt.col = jan_inicio_classe(jan, lin, pos, grande);
 }
 
-// move o cursor para o final da palavra (o primeiro caractere não espaço
-// seguido por um espaço ou pelo final de linha após o cursor)
-void jan_cursor_final_palavra_direita(janela_t *jan)
+// move o cursor para o final da palavra (o último caractere da palavra
+// que termina após o cursor)
+void jan_cursor_final_palavra_direita(janela_t *jan, bool grande)
 {
-  str lin = jan_linha_corrente(jan);
+  if (ls_vazia(jan->txt->linhas)) return;
+  int lin = jan->cursor_txt.lin;
   int pos = jan->cursor_txt.col + 1;
-  if (pos >= s_tam(lin)) pos = -1;
-  else pos = s_busca_nc(lin, pos, s_(" "));
-  if (pos == -1) {
-    if (jan->cursor_txt.lin == ls_tam(jan->txt->linhas)) return;
-    jan->cursor_txt.lin++;
-    lin = jan_linha_corrente(jan); 
-    pos = s_busca_nc(lin, 0, s_(" "));
+  if (jan_espaco_em(jan, lin, pos)) pos = jan_fim_classe(jan, lin, pos, grande);
+  if (pos >= jan_tam_linha(jan, lin)) {
+    if (lin >= ls_tam(jan->txt->linhas) - 1) return;
+    lin++;
+    pos = 0;
+    if (jan_espaco_em(jan, lin, pos)) pos = jan_fim_classe(jan, lin, pos, grande);
   }
-  pos = s_busca_c(lin, pos, s_(" "));
-  if (pos == -1) pos = s_tam(lin);
-  else pos--;
+  if (pos < jan_tam_linha(jan, lin)) pos = jan_fim_classe(jan, lin, pos, grande) - 1;
+  jan->cursor_txt.lin = lin;
   jan->cursor_txt.col = pos;
 }
 
@@ -423,7 +624,9 @@ void jan_troca_ancora(janela_t *jan)
 }
 
 // posiciona a lista linhas na linha atual do cursor
+// a linha em edição volta antes para a lista
 static void jan_posiciona_lista(janela_t *jan){
+  jan_descarrega_linha(jan);
   ls_posiciona(jan->txt->linhas,jan->cursor_txt.lin);
 }
 
@@ -443,7 +646,7 @@ void jan_abre_linha_acima(janela_t *jan) {
 //   a partir da posição do cursor é movido para uma nova linha)
 void jan_quebra_linha(janela_t *jan) {
   jan_posiciona_lista(jan);
-  str* textoLinha = ls_item_ptr(jan->txt->linhas);
+  str* textoLinha = texto_linha_alteravel(jan->txt);
   str resto = s_copia(s_sub(*textoLinha,jan->cursor_txt.col,textoLinha->tamc));
   s_subst(textoLinha,jan->cursor_txt.col,textoLinha->tamc,s_(""),s_(""));
   ls_posiciona(jan->txt->linhas,jan->cursor_txt.lin);
@@ -454,7 +657,7 @@ void jan_quebra_linha(janela_t *jan) {
 //   linha do cursor
 void jan_junta_linhas(janela_t *jan) {
   jan_posiciona_lista(jan);
-  str* atual = ls_item_ptr(jan->txt->linhas);
+  str* atual = texto_linha_alteravel(jan->txt);
   ls_avanca(jan->txt->linhas);
   str* prox = ls_item_ptr(jan->txt->linhas);
   s_cat(atual,*prox);
@@ -462,31 +665,60 @@ void jan_junta_linhas(janela_t *jan) {
 }
 // remove o caractere sob o cursor
 void jan_remove_char(janela_t *jan) {
-  jan_posiciona_lista(jan);
-  str* atual = ls_item_ptr(jan->txt->linhas);
-  s_subst(atual,jan->cursor_txt.col,1,s_(""),s_(""));
+  jan_altera_linha(jan, jan->cursor_txt.col, 1, s_(""));
 }
 // altera o caractere sob o cursor para ter o valor de uni
 void jan_altera_char(janela_t *jan, unichar uni) {
-  jan_posiciona_lista(jan);
-  str* atual = ls_item_ptr(jan->txt->linhas);
   byte* caracter = (byte*)malloc(4*sizeof(byte));
   int cBytes = u8_converte_pra_utf8(uni,caracter);
   str sCaracter = s_cria_buf(caracter,cBytes,1);
-  s_subst(atual,jan->cursor_txt.col,1,sCaracter,s_(""));
+  jan_altera_linha(jan, jan->cursor_txt.col, 1, sCaracter);
   free(caracter);
 }
 // insere o caractere com o valor de uni logo antes do caractere do cursor
 void jan_insere_char(janela_t *jan, unichar uni) {
-  jan_posiciona_lista(jan);
-  str* atual = ls_item_ptr(jan->txt->linhas);
   byte* caracter = (byte*)malloc(4*sizeof(byte));
   int cBytes = u8_converte_pra_utf8(uni,caracter);
   str sCaracter = s_cria_buf(caracter,cBytes,1);
-  s_subst(atual,jan->cursor_txt.col,0,sCaracter,s_(""));
+  jan_altera_linha(jan, jan->cursor_txt.col, 0, sCaracter);
   free(caracter);
 }
 
+// troca a caixa (maiúscula/minúscula) do caractere sob o cursor
+void jan_alterna_caixa_char(janela_t *jan)
+{
+  jan_posiciona_lista(jan);
+  Lstr linhas = jan->txt->linhas;
+  if (ls_tam(linhas) == 0) ls_insere_antes(linhas, s_(""));
+  s_alterna_caixa(texto_linha_alteravel(jan->txt), jan->cursor_txt.col, 1);
+}
+
+// altera a caixa do texto selecionado no modo dado, usando a função altera
+//   (s_maiuscula, s_minuscula ou s_alterna_caixa) em cada linha
+// a lista de linhas é percorrida uma vez só, do início ao final da seleção
+void jan_altera_caixa_selecao(janela_t *jan, modo_t modo, void (*altera)(str *, int, int))
+{
+  jan_descarrega_linha(jan);
+  posicao_t pos_ini = pos_antes(jan->cursor_txt, jan->ancora);
+  posicao_t pos_fim = pos_depois(jan->cursor_txt, jan->ancora);
+  Lstr linhas = jan->txt->linhas;
+  if (ls_tam(linhas) == 0) ls_insere_antes(linhas, s_(""));
+  ls_posiciona(linhas, pos_ini.lin);
+  for (int lin = pos_ini.lin; lin <= pos_fim.lin; lin++) {
+    str *plinha = texto_linha_alteravel(jan->txt);
+    int col_ini = 0;
+    int col_fim = s_tam(*plinha);
+    if (modo == selecao_caractere) {
+      if (lin == pos_ini.lin) col_ini = pos_ini.col;
+      if (lin == pos_fim.lin) col_fim = pos_fim.col + 1;
+    }
+    altera(plinha, col_ini, col_fim - col_ini);
+    ls_avanca(linhas);
+  }
+  // como no vi, o cursor vai para o início da seleção
+  jan->cursor_txt = pos_ini;
+}
+
 // remove o caractere à esquerda do cursor, se houver
 void jan_remove_char_esquerda(janela_t *jan)
 {
@@ -529,6 +761,7 @@ static Lstr jan_copia_selecao_1linha(janela_t *jan)
 // retorna uma lista com o conteúdo da seleção, no modo dado
 Lstr jan_copia_selecao(janela_t *jan, modo_t modo)
 {
+  jan_descarrega_linha(jan);
   if (modo == selecao_linha) return jan_copia_selecao_linhas(jan);
   if (jan->cursor_txt.lin == jan->ancora.lin) return jan_copia_selecao_1linha(jan);
   // seleção por caracteres, em linhas diferentes
@@ -569,6 +802,7 @@ static void jan_remove_linhas(janela_t *jan, int linha_inicial, int linha_final)
 // remove a seleção do texto, no modo dado
 void jan_remove_selecao(janela_t *jan, modo_t modo)
 {
+  jan_descarrega_linha(jan);
   if (modo == selecao_linha) {
     // remove as linhas entre o cursor e a âncora (da menor pra maior)
     int ini = menor(jan->cursor_txt.lin, jan->ancora.lin);
@@ -588,7 +822,7 @@ void jan_remove_selecao(janela_t *jan, modo_t modo)
     // pega a primeira linha
     Lstr linhas = jan->txt->linhas;
     ls_posiciona(linhas, pos_ini.lin);
-    str *plinha = ls_item_ptr(linhas);
+    str *plinha = texto_linha_alteravel(jan->txt);
     if (pos_ini.lin == pos_fim.lin) {
       // está tudo em uma linha só
       s_subst(plinha, pos_ini.col, pos_fim.col - pos_ini.col + 1, s_(""), s_(""));
@@ -607,16 +841,17 @@ void jan_remove_selecao(janela_t *jan, modo_t modo)
 // cola o texto em sel no modo dado, antes da posição do cursor
 void jan_cola_selecao_antes(janela_t *jan, Lstr sel, modo_t modo)
 {
+  jan_descarrega_linha(jan);
   if (modo == selecao_linha) {
     Lstr linhas = jan->txt->linhas;
     ls_posiciona(linhas, jan->cursor_txt.lin);
     for (ls_final(sel); ls_recua(sel); ) {
-      ls_insere_antes(linhas, s_copia(ls_item(sel)));
+      ls_insere_antes(linhas, ls_item(sel));
     }
   } else if (modo == selecao_caractere) {
     Lstr linhas = jan->txt->linhas;
     ls_posiciona(linhas, jan->cursor_txt.lin);
-    str *plinha = ls_item_ptr(linhas);
+    str *plinha = texto_linha_alteravel(jan->txt);
     ls_posiciona(sel, 0);
     str lin_sel = ls_item(sel);
     int tam_sel = ls_tam(sel);
@@ -633,23 +868,25 @@ void jan_cola_selecao_antes(janela_t *jan, Lstr sel, modo_t modo)
     s_subst(plinha, jan->cursor_txt.col, s_tam(*plinha), lin_sel, s_(""));
     for (int i = 1; i < tam_sel - 1; i++) {
       ls_avanca(sel);
-      ls_insere_depois(linhas, s_copia(ls_item(sel)));
+      ls_insere_depois(linhas, ls_item(sel));
     }
     ls_avanca(sel);
     lin_sel = ls_item(sel);
     s_subst(&resto, 0, 0, lin_sel, s_(""));
     ls_insere_depois(linhas, resto);
+    s_destroi(resto);
   }
 }
 
 // cola o texto em sel no modo dado, depois da posição do cursor
 void jan_cola_selecao_depois(janela_t *jan, Lstr sel, modo_t modo)
 {
+  jan_descarrega_linha(jan);
   if (modo == selecao_linha) {
     Lstr linhas = jan->txt->linhas;
     ls_posiciona(linhas, jan->cursor_txt.lin);
     for (ls_inicio(sel); ls_avanca(sel); ) {
-      ls_insere_depois(linhas, s_copia(ls_item(sel)));
+      ls_insere_depois(linhas, ls_item(sel));
     }
     jan->cursor_txt.lin++;
   } else if (modo == selecao_caractere) {
@@ -674,11 +911,11 @@ void jan_poe_cursor_no_texto(janela_t *jan, bool deixa_ficar_apos_final)
     jan->cursor_txt.col = 0;
     return;
   }
-  str linha = ls_item(linhas);
+  int tam = jan_tam_linha(jan, jan->cursor_txt.lin);
   if (deixa_ficar_apos_final) {
-    if (jan->cursor_txt.col > s_tam(linha)) jan->cursor_txt.col = s_tam(linha);
+    if (jan->cursor_txt.col > tam) jan->cursor_txt.col = tam;
   } else {
-    if (jan->cursor_txt.col > s_tam(linha) - 1) jan->cursor_txt.col = s_tam(linha) - 1;
+    if (jan->cursor_txt.col > tam - 1) jan->cursor_txt.col = tam - 1;
     if (jan->cursor_txt.col < 0) jan->cursor_txt.col = 0;
   }
 }
@@ -706,6 +943,20 @@ void jan_poe_janela_no_cursor(janela_t *jan)
     ultima_coluna = jan->cursor_txt.col;
     jan->inicio_txt.col = ultima_coluna - (jan->tamanho.larg - 7);
   }
+  // a conta acima considera que cada caractere ocupa uma coluna da tela;
+  //   se tem caracteres largos, pode ser necessário avançar mais
+  Lstr linhas = jan->txt->linhas;
+  ls_posiciona(linhas, jan->cursor_txt.lin);
+  if (ls_item_valido(linhas)) {
+    while (jan->inicio_txt.col < jan->cursor_txt.col) {
+      int ncols = jan->cursor_txt.col - jan->inicio_txt.col + 1;
+      str ate_cursor = jan_trecho(jan, jan->cursor_txt.lin, jan->inicio_txt.col, ncols);
+      // o cursor pode estar após o final da linha, ocupando uma coluna
+      int larg = s_largura(ate_cursor) + ncols - s_tam(ate_cursor);
+      if (larg <= jan->tamanho.larg - 6) break;
+      jan->inicio_txt.col++;
+    }
+  }
 
   // não pode ser negativo
   if (jan->inicio_txt.lin < 0) jan->inicio_txt.lin = 0;
@@ -721,18 +972,26 @@ typedef struct {
   modo_t modo;   // modo atual do editor
   Lstr selecao;  // texto copiado da seleção
   modo_t modo_selecao; // modo como a seleção foi copiada
+  tecla prefixo; // 'g' se for o início de um comando de 2 teclas, ou t_none
   bool termina;  // true se deve encerrar o programa
 } editor_t;
 
-editor_t *ed_cria()
+// cria um editor para o arquivo chamado nome_arquivo
+// se normaliza for true, o texto é convertido para NFC na leitura (ver
+//   texto_cria)
+// retorna NULL, com errno indicando o erro, se o arquivo não puder ser lido
+editor_t *ed_cria(str nome_arquivo, bool normaliza)
 {
+  texto_t *txt = texto_cria(nome_arquivo, normaliza);
+  if (txt == NULL) return NULL;
   editor_t *ed = malloc(sizeof(*ed));
   assert(ed != NULL);
-  ed->txt = texto_cria(s_("exemplo.txt"));
+  ed->txt = txt;
   ed->jan = jan_cria(ed->txt);
   ed->modo = normal;
   ed->termina = false;
   ed->selecao = NULL;
+  ed->prefixo = t_none;
   return ed;
 }
 
@@ -754,6 +1013,8 @@ janela_t *ed_janela_corrente(editor_t *ed)
 void ed_troca_modo(editor_t *ed, modo_t modo)
 {
   ed->modo = modo;
+  // nesses modos, cada tecla altera a linha do cursor
+  if (modo == insercao || modo == troca) jan_edita_linha(ed_janela_corrente(ed));
 }
 
 bool ed_processa_tecla_global(editor_t *ed, tecla tec)
@@ -795,13 +1056,13 @@ bool ed_processa_movimentos(editor_t *ed, tecla tec)
     case '$': jan_cursor_final_linha(jan); break;
     case 'g': jan_cursor_inicio_texto(jan); break; // no vi, é 'gg'
     case 'G': jan_cursor_final_texto(jan); break;
-    // sem distinção entre palavra minúscula e maiúscula
-    case 'w': jan_cursor_inicio_palavra_direita(jan); break;
-    case 'W': jan_cursor_inicio_palavra_direita(jan); break;
-    case 'b': jan_cursor_inicio_palavra_esquerda(jan); break;
-    case 'B': jan_cursor_inicio_palavra_esquerda(jan); break;
-    case 'e': jan_cursor_final_palavra_direita(jan); break;
-    case 'E': jan_cursor_final_palavra_direita(jan); break;
+    // minúscula: palavra por classe de caractere; maiúscula: até espaço
+    case 'w': jan_cursor_inicio_palavra_direita(jan, false); break;
+    case 'W': jan_cursor_inicio_palavra_direita(jan, true); break;
+    case 'b': jan_cursor_inicio_palavra_esquerda(jan, false); break;
+    case 'B': jan_cursor_inicio_palavra_esquerda(jan, true); break;
+    case 'e': jan_cursor_final_palavra_direita(jan, false); break;
+    case 'E': jan_cursor_final_palavra_direita(jan, true); break;
     default: processou = false;
   }
   return processou;
@@ -828,6 +1089,7 @@ void ed_processa_tecla_normal(editor_t *ed, tecla tec)
     case 'J': jan_cursor_final_linha(jan); jan_junta_linhas(jan); break;
     case 'x': jan_remove_char(jan); break;
     case t_del: jan_remove_char(jan); break;
+    case '~': jan_alterna_caixa_char(jan); jan_cursor_direita(jan); break;
     case 'p': jan_cola_selecao_depois(jan, ed->selecao, ed->modo_selecao); break;
     case 'P': jan_cola_selecao_antes(jan, ed->selecao, ed->modo_selecao); break;
     default: ; // ignora teclas não tratadas
@@ -887,19 +1149,35 @@ void ed_copia_selecao(editor_t *ed)
   janela_t *jan = ed_janela_corrente(ed);
   ed->modo_selecao = ed->modo;
   ed->selecao = jan_copia_selecao(jan, ed->modo_selecao);
-  faz_lista_ter_copias_das_strings(ed->selecao);
 }
 
 // está em modo seleção e recebeu a tecla tec
 // faz o que tem que ser feito nesse caso
 void ed_processa_tecla_selecao(editor_t *ed, tecla tec)
 {
-  if (ed_processa_movimentos(ed, tec)) return;
   janela_t *jan = ed_janela_corrente(ed);
+  if (ed->prefixo == 'g') {
+    // gU, gu: conversão de caixa; gg ou qualquer outra: início do texto
+    ed->prefixo = t_none;
+    switch ((int)tec) {
+      case 'U': jan_altera_caixa_selecao(jan, ed->modo, s_maiuscula); ed_troca_modo(ed, normal); return;
+      case 'u': jan_altera_caixa_selecao(jan, ed->modo, s_minuscula); ed_troca_modo(ed, normal); return;
+      case 'g': jan_cursor_inicio_texto(jan); return;
+      default: jan_cursor_inicio_texto(jan);
+    }
+  }
+  if (tec == 'g') {
+    ed->prefixo = 'g';
+    return;
+  }
+  if (ed_processa_movimentos(ed, tec)) return;
   switch ((int)tec) {
     case 'v': ed_troca_modo(ed, ed->modo == selecao_caractere ? normal : selecao_caractere); break;
     case 'V': ed_troca_modo(ed, ed->modo == selecao_linha ? normal : selecao_linha); break;
     case 'o': jan_troca_ancora(jan); break;
+    case '~': jan_altera_caixa_selecao(jan, ed->modo, s_alterna_caixa); ed_troca_modo(ed, normal); break;
+    case 'U': jan_altera_caixa_selecao(jan, ed->modo, s_maiuscula); ed_troca_modo(ed, normal); break;
+    case 'u': jan_altera_caixa_selecao(jan, ed->modo, s_minuscula); ed_troca_modo(ed, normal); break;
     case 'y': ed_copia_selecao(ed); break;
     case 'c': ed_copia_selecao(ed); jan_remove_selecao(jan, ed->modo); ed_troca_modo(ed, insercao); break;
     case 'd': ed_copia_selecao(ed); jan_remove_selecao(jan, ed->modo); ed_troca_modo(ed, normal); break;
@@ -928,6 +1206,8 @@ void ed_processa_tecla(editor_t *ed)
   }
   jan_poe_cursor_no_texto(jan, ed->modo == insercao || ed->modo == troca);
   jan_poe_janela_no_cursor(jan);
+  // a linha em edição volta para a lista quando o cursor sai dela
+  if (jan->lin_edicao != jan->cursor_txt.lin) jan_descarrega_linha(jan);
 }
 
 // desenha toda a tela e coloca o cursor na posição corrente
@@ -945,10 +1225,28 @@ void ed_desenha_tela(editor_t *ed)
     tela_seleciona_cursor(bloco);
 }
 
-int main()
+// a opção -n faz o texto ser normalizado para NFC na leitura
+int main(int argc, char *argv[])
 {
+  bool normaliza = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0) normaliza = true;
+  }
+  // as linhas do texto são copiadas e apagadas aos pedaços; cópias exatas
+  //   não desperdiçam memória com linhas que não são alteradas, e só
+  //   reduzir a memória com bastante sobra evita realocar a cada tecla
+  s_define_politica((s_politica_t){ .copia_exata = true, .limite_encolhe = 8 });
+  char *nome_arquivo = "exemplo.txt";
   tela_cria();
-  editor_t *ed = ed_cria();
+  editor_t *ed = ed_cria(s_cria(nome_arquivo), normaliza);
+  if (ed == NULL) {
+    // o erro é mostrado depois de a tela voltar ao normal
+    int erro = errno;
+    tela_destroi();
+    fflush(stdout);
+    fprintf(stderr, "%s: %s\n", nome_arquivo, strerror(erro));
+    return 1;
+  }
 
   while (!ed->termina) {
     ed_processa_tecla(ed);
@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+# gera_tabelas.py
+# ---------------
+# gera utf8_tabelas.h, com as tabelas de propriedades unicode usadas por utf8.c
+# as tabelas são geradas a partir do banco de dados unicode do python
+#   (módulo unicodedata), e a versão usada é registrada no arquivo gerado
+#
+# uso: python3 gera_tabelas.py > utf8_tabelas.h
+
+import unicodedata
+
+# as tabelas em dois níveis cobrem os códigos abaixo de LIMITE (planos 0 a 3);
+#   acima disso, as propriedades são tratadas diretamente em utf8.c
+LIMITE = 0x40000
+
+
+def largura(cp):
+    """número de colunas que o caractere ocupa em um terminal (0, 1 ou 2)"""
+    c = chr(cp)
+    cat = unicodedata.category(c)
+    if cp == 0xAD:  # hífen opcional é mostrado
+        return 1
+    if cat in ('Mn', 'Me', 'Cf', 'Cc'):
+        return 0
+    if 0x1160 <= cp <= 0x11FF or cp == 0x200B:  # jamo medial/final, espaço de largura 0
+        return 0
+    if cat == 'Cn':
+        # não atribuídos: largos nos planos reservados para ideogramas
+        return 2 if 0x20000 <= cp <= 0x3FFFD else 1
+    if unicodedata.east_asian_width(c) in ('W', 'F'):
+        return 2
+    return 1
+
+
+# classes de caracteres para movimentação por palavras (u8_classe_t)
+ESPACO, PALAVRA, PONTUACAO, IDEOGRAMA = range(4)
+
+
+def classe(cp):
+    """classe do caractere, para separar palavras"""
+    c = chr(cp)
+    cat = unicodedata.category(c)
+    if cp in (0x09, 0x0A, 0x0B, 0x0C, 0x0D) or cat in ('Zs', 'Zl', 'Zp'):
+        return ESPACO
+    if cat in ('Lo', 'Lm') and unicodedata.east_asian_width(c) in ('W', 'F'):
+        return IDEOGRAMA  # ideogramas, kana, hangul: cada sequência é uma palavra
+    if cat[0] in ('L', 'M', 'N') or cat in ('Pc', 'Cn', 'Co'):
+        return PALAVRA
+    return PONTUACAO
+
+
+def maiuscula(cp):
+    """mapeamento simples (um caractere para um) para maiúscula"""
+    c = chr(cp)
+    for m in (c.upper(), c.title()):
+        # o python usa o mapeamento completo (que pode gerar mais de um
+        #   caractere); nesse caso, o titlecase costuma ser o mapeamento simples
+        if len(m) == 1:
+            return ord(m)
+    return cp
+
+
+def minuscula(cp):
+    """mapeamento simples (um caractere para um) para minúscula"""
+    if cp == 0x130:  # I com ponto: o mapeamento completo é i + ponto combinante
+        return ord('i')
+    m = chr(cp).lower()
+    return ord(m) if len(m) == 1 else cp
+
+
+# o hangul é decomposto e composto por algoritmo, em utf8.c
+HANGUL_SILABAS = range(0xAC00, 0xD7A4)
+
+
+def decomposicao(cp):
+    """decomposição canônica completa (NFD) do caractere"""
+    if cp in HANGUL_SILABAS:
+        return [cp]
+    return [ord(x) for x in unicodedata.normalize('NFD', chr(cp))]
+
+
+def pares_composicao():
+    """(primeiro, segundo, composto) para os compostos primários, os que
+    podem ser produzidos pela composição canônica"""
+    pares = []
+    for cp in range(0x110000):
+        d = unicodedata.decomposition(chr(cp))
+        if d and not d.startswith('<') and cp not in HANGUL_SILABAS:
+            d = [int(x, 16) for x in d.split()]
+            if len(d) == 2 and unicodedata.normalize('NFC', chr(cp)) == chr(cp):
+                pares.append((d[0], d[1], cp))
+    return pares
+
+
+def nfc_rapido(segundos):
+    """retorna a função que diz se um caractere passa na verificação rápida
+    de NFC: 0 sim, 1 tem classe de combinação, 2 pode combinar com o
+    anterior, 3 não está em NFC"""
+    def valor(cp):
+        c = chr(cp)
+        if unicodedata.normalize('NFC', c) != c:
+            return 3
+        if cp in segundos or 0x1161 <= cp <= 0x1175 or 0x11A8 <= cp <= 0x11C2:
+            return 2
+        if unicodedata.combining(c) != 0:
+            return 1
+        return 0
+    return valor
+
+
+def tam_utf8(cp):
+    return len(chr(cp).encode('utf-8', 'surrogatepass'))
+
+
+def imprime_vetor(tipo, nome, valores, formato):
+    """imprime a declaração de um vetor constante com os valores dados"""
+    print(f'static const {tipo} {nome}[{len(valores)}] = {{')
+    fmt = '0x{:x}' if formato == 'x' else '{}'
+    for i in range(0, len(valores), 8):
+        print('  ' + ','.join(fmt.format(x) for x in valores[i:i + 8]) + ',')
+    print('};')
+    print()
+
+
+def tabela_2_niveis(nome, valor, bits, tam_bloco):
+    """gera uma tabela de dois níveis para a função valor, com bits bits
+    por código; o 1o nível, indexado por cp / tam_bloco, tem o número do
+    bloco do 2o nível; blocos iguais são armazenados uma vez só"""
+    por_byte = 8 // bits
+    blocos = {}
+    indice = []
+    for b in range(LIMITE // tam_bloco):
+        vals = tuple(valor(cp) for cp in range(b * tam_bloco, (b + 1) * tam_bloco))
+        indice.append(blocos.setdefault(vals, len(blocos)))
+    assert len(blocos) <= 256
+    print(f'// {nome}: {bits} bits por código, blocos de {tam_bloco} códigos')
+    print(f'#define {nome.upper()}_BITS_BLOCO {tam_bloco.bit_length() - 1}')
+    print(f'static const byte {nome}_indice[{len(indice)}] = {{')
+    for i in range(0, len(indice), 16):
+        print('  ' + ','.join(f'{x}' for x in indice[i:i + 16]) + ',')
+    print('};')
+    print(f'static const byte {nome}_blocos[{len(blocos)}][{tam_bloco // por_byte}] = {{')
+    for vals in blocos:
+        bytes_ = []
+        for i in range(0, tam_bloco, por_byte):
+            v = 0
+            for j in range(por_byte):
+                v |= vals[i + j] << (j * bits)
+            bytes_.append(v)
+        print('  {' + ','.join(f'0x{x:02x}' for x in bytes_) + '},')
+    print('};')
+    print()
+
+
+def main():
+    print('// utf8_tabelas.h')
+    print('// gerado por gera_tabelas.py, não deve ser alterado diretamente')
+    print(f'// unicode {unicodedata.unidata_version}')
+    print()
+    tabela_2_niveis('u8_tab_largura', largura, 2, 128)
+    tabela_2_niveis('u8_tab_classe', classe, 2, 128)
+    # as tabelas de caixa têm, para cada código, o índice em
+    #   u8_tab_caixa_deltas da diferença entre o código convertido e o original
+    deltas = {0: 0}
+    for f in (maiuscula, minuscula):
+        for cp in range(LIMITE):
+            # a conversão não pode aumentar o número de bytes em mais de 50%
+            assert 2 * tam_utf8(f(cp)) <= 3 * tam_utf8(cp)
+            deltas.setdefault(f(cp) - cp, len(deltas))
+    assert all(f(cp) == cp for f in (maiuscula, minuscula)
+               for cp in range(LIMITE, 0x110000))
+    print('// u8_tab_caixa_deltas: diferença entre o código convertido e o original')
+    print(f'static const int u8_tab_caixa_deltas[{len(deltas)}] = {{')
+    lista = list(deltas)
+    for i in range(0, len(lista), 10):
+        print('  ' + ','.join(f'{x}' for x in lista[i:i + 10]) + ',')
+    print('};')
+    print()
+    tabela_2_niveis('u8_tab_maiuscula', lambda cp: deltas[maiuscula(cp) - cp], 8, 128)
+    tabela_2_niveis('u8_tab_minuscula', lambda cp: deltas[minuscula(cp) - cp], 8, 128)
+
+    # normalização NFC
+    pares = pares_composicao()
+    segundos = {b for a, b, c in pares}
+    nfc = nfc_rapido(segundos)
+    assert all(nfc(cp) == 0 for cp in range(LIMITE, 0x110000) if not 0xD800 <= cp < 0xE000)
+    tabela_2_niveis('u8_tab_nfc', nfc, 2, 128)
+    tabela_2_niveis('u8_tab_ccc', lambda cp: unicodedata.combining(chr(cp)), 8, 128)
+    decomps = [(cp, decomposicao(cp)) for cp in range(LIMITE)]
+    decomps = [(cp, d) for cp, d in decomps if d != [cp]]
+    inicio = [0]
+    for cp, d in decomps:
+        inicio.append(inicio[-1] + len(d))
+    print('// decomposição canônica completa dos caracteres em u8_tab_decomp_codigos')
+    print('//   (em ordem): a do i-ésimo está em u8_tab_decomp_seq, de')
+    print('//   u8_tab_decomp_inicio[i] até antes de u8_tab_decomp_inicio[i+1]')
+    print(f'#define U8_TAB_DECOMP_MAX {max(len(d) for cp, d in decomps)}')
+    imprime_vetor('unichar', 'u8_tab_decomp_codigos', [cp for cp, d in decomps], 'x')
+    imprime_vetor('unsigned short', 'u8_tab_decomp_inicio', inicio, 'd')
+    imprime_vetor('unichar', 'u8_tab_decomp_seq', [x for cp, d in decomps for x in d], 'x')
+    for a, b, c in pares:
+        assert tam_utf8(c) <= tam_utf8(a) + tam_utf8(b)
+    pares.sort()
+    print('// composição canônica: u8_tab_comp_pares tem (primeiro << 21) | segundo,')
+    print('//   em ordem, e u8_tab_comp_compostos o caractere composto correspondente')
+    imprime_vetor('unsigned long long', 'u8_tab_comp_pares', [a << 21 | b for a, b, c in pares], 'x')
+    imprime_vetor('unichar', 'u8_tab_comp_compostos', [c for a, b, c in pares], 'x')
+
+
+main()
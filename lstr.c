@@ -5,10 +5,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+// strings com menos bytes que isso são guardadas no próprio nó (em buf),
+//   para que cada item precise de uma só alocação
+#define MAX_EMBUTIDA 64
+
 typedef struct no{
     struct no* ant;
     struct no* prox;
     str string;
+    byte buf[];
 } no;
 
 struct lstr{
@@ -17,18 +22,29 @@ struct lstr{
     no* corrente;
     int tam;
     int pos;
+    s_arena* arena;
 };
 
 Lstr ls_cria(){
+    return ls_cria_na_arena(NULL);
+}
+
+Lstr ls_cria_na_arena(s_arena* arena){
     Lstr new = malloc(sizeof(struct lstr));
     new->primeiro = NULL;
     new->ultimo = NULL;
     new->corrente = NULL;
     new->tam = 0;
     new->pos = -1;
+    new->arena = arena;
     return new;
 }
 
+// libera a memória de um nó, se não for da arena
+static void libera_no(Lstr self, no* velho){
+    if(self->arena == NULL) free(velho);
+}
+
 void ls_destroi(Lstr self){
     if(ls_vazia(self)){ 
         free(self);
@@ -38,7 +54,8 @@ void ls_destroi(Lstr self){
     while(self->primeiro != NULL){
         no* primeiro = self->primeiro;
         self->primeiro = primeiro->prox;
-        free(primeiro);
+        s_destroi(primeiro->string);
+        libera_no(self,primeiro);
     }
     free(self);
 }
@@ -115,16 +132,26 @@ bool ls_recua(Lstr self){
     return (self->corrente == NULL)?0:1;
 }
 
-static no* cria_no(no* ant, no* prox, str cad){
-    no* new = malloc(sizeof(no));
+// se copia for false, o nó guarda a própria cad (ver ls_insere_depois_sem_copia)
+static no* cria_no(Lstr self, no* ant, no* prox, str cad, bool copia){
+    // o buffer embutido tem espaço para o \0 e sobra até um múltiplo de 8
+    // na arena, qualquer string copiada fica no nó
+    int tam_buf = 0;
+    if(copia && (cad.tamb < MAX_EMBUTIDA || self->arena != NULL)) tam_buf = (cad.tamb + 8) & ~7;
+    no* new;
+    if(self->arena != NULL) new = s_arena_aloca(self->arena,sizeof(no) + tam_buf);
+    else new = malloc(sizeof(no) + tam_buf);
+    assert(new != NULL);
     new->ant = ant;
     new->prox = prox;
-    new->string = s_copia(cad);
+    if(!copia) new->string = cad;
+    else if(tam_buf > 0) new->string = s_copia_buf(cad,new->buf,tam_buf);
+    else new->string = s_copia(cad);
     return new;
 }
 
-static void insere_lista_vazia(Lstr self, str cad){
-    no* novo = cria_no(NULL,NULL,cad);
+static void insere_lista_vazia(Lstr self, str cad, bool copia){
+    no* novo = cria_no(self,NULL,NULL,cad,copia);
     self->primeiro = novo;
     self->ultimo = novo;
     ls_avanca(self);
@@ -132,8 +159,8 @@ static void insere_lista_vazia(Lstr self, str cad){
     self->tam += 1;
 }
 
-static void insere_inicio(Lstr self, str cad){
-    no* novo = cria_no(NULL,self->primeiro,cad);
+static void insere_inicio(Lstr self, str cad, bool copia){
+    no* novo = cria_no(self,NULL,self->primeiro,cad,copia);
     self->primeiro->ant = novo;
     self->primeiro = novo;
     self->corrente = novo;
@@ -141,8 +168,8 @@ static void insere_inicio(Lstr self, str cad){
     self->tam += 1;
 }
 
-static void insere_final(Lstr self, str cad){
-    no* novo = cria_no(self->ultimo,NULL,cad);
+static void insere_final(Lstr self, str cad, bool copia){
+    no* novo = cria_no(self,self->ultimo,NULL,cad,copia);
     self->ultimo->prox = novo;
     self->ultimo = novo;
     self->corrente = novo;
@@ -157,46 +184,54 @@ static void desloca_lista_inserir(Lstr self, no* new, no* anterior, no* proximo)
 
 void ls_insere_antes(Lstr self, str cad){
     if(ls_vazia(self)){
-        insere_lista_vazia(self,cad);
+        insere_lista_vazia(self,cad,true);
         return;
     }
     if(self->pos <= 0){
-        insere_inicio(self,cad);
+        insere_inicio(self,cad,true);
         return;
     }
     if(self->pos == self->tam){
-        insere_final(self,cad);
+        insere_final(self,cad,true);
         return;
     }
     no* proximo = self->corrente;
     no* anterior = self->corrente->ant;
-    no* novo = cria_no(anterior,proximo,cad);
+    no* novo = cria_no(self,anterior,proximo,cad,true);
     desloca_lista_inserir(self,novo,anterior,proximo);
     self->corrente = novo;
     self->tam += 1;
 }
 
-void ls_insere_depois(Lstr self, str cad){
+static void insere_depois(Lstr self, str cad, bool copia){
     if(ls_vazia(self)){
-        insere_lista_vazia(self,cad);
+        insere_lista_vazia(self,cad,copia);
         return;
     }
     if(self->pos < 0){
-        insere_inicio(self,cad);
+        insere_inicio(self,cad,copia);
         return;
     }
     if(self->pos >= self->tam-1){
-        insere_final(self,cad);
+        insere_final(self,cad,copia);
         return;
     }
     no* proximo = self->corrente->prox;
     no* anterior = self->corrente;
-    no* novo = cria_no(anterior,proximo,cad);
+    no* novo = cria_no(self,anterior,proximo,cad,copia);
     desloca_lista_inserir(self,novo,anterior,proximo);
     self->corrente = novo;
     self->tam += 1;
 }
 
+void ls_insere_depois(Lstr self, str cad){
+    insere_depois(self,cad,true);
+}
+
+void ls_insere_depois_sem_copia(Lstr self, str cad){
+    insere_depois(self,cad,false);
+}
+
 str ls_remove(Lstr self){
     assert(!ls_vazia(self) && ls_item_valido(self));
     str strRemovida = s_copia(self->corrente->string);
@@ -208,7 +243,7 @@ str ls_remove(Lstr self){
     self->corrente = remover->prox;
     if(self->primeiro == remover) self->primeiro = remover->prox;
     if(self->ultimo == remover) self->ultimo = remover->ant;
-    free(remover);
+    libera_no(self,remover);
     return strRemovida;
 }
 
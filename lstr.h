@@ -50,6 +50,14 @@ typedef struct lstr *Lstr;
 //   ser destruída (com ls_destroi) quando a lista não for mais necessária
 Lstr ls_cria();
 
+// cria e retorna uma lista vazia, que guarda seus itens na arena
+// cada item (a string e os dados da lista) ocupa uma só alocação na arena;
+//   as strings que crescerem deixam a arena
+// a memória dos itens removidos só é recuperada com a destruição da arena,
+//   que deve ocorrer após a destruição da lista
+// se arena for NULL, é o mesmo que ls_cria
+Lstr ls_cria_na_arena(s_arena *arena);
+
 // destrói uma lista
 // essa lista não deve ser utilizada após essa chamada
 // esta função destrói a lista, e as strings que ela contém
@@ -129,6 +137,14 @@ void ls_insere_antes(Lstr self, str cad);
 // a posição corrente passa a ser a do item inserido
 void ls_insere_depois(Lstr self, str cad);
 
+// como ls_insere_depois, mas o item é a própria cad, sem cópia
+// se cad for alterável, passa a pertencer à lista, e não deve mais ser usada
+//   nem destruída por quem chamou
+// se não for, o item referencia a memória de cad, que deve continuar
+//   existindo enquanto o item existir; o item não é alterável, e deve ser
+//   trocado por uma cópia (pelo ponteiro de ls_item_ptr) para ser alterado
+void ls_insere_depois_sem_copia(Lstr self, str cad);
+
 // remove e retorna a string da posição corrente, que deve ser válida
 // a posição corrente passa a ser a do item seguinte ao removido ou após o
 //   final se foi removido o item no final da lista
@@ -0,0 +1,436 @@
+#include "rope.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#define MAX_FOLHA 4096 // número máximo de bytes em uma folha
+#define TAM_FOLHA 3072 // bytes nas folhas de uma corda construída de uma vez
+                       //   (deixa espaço para inserções sem dividir a folha)
+
+typedef struct no_rope no_rope;
+
+// nó da árvore (uma árvore AVL, ordenada pela posição no texto)
+// as folhas têm esq e dir NULL, e o texto em folha, que nunca é vazio e é
+//   sempre alterável; os nós internos têm sempre os dois filhos
+struct no_rope {
+  no_rope *esq;
+  no_rope *dir;
+  int tamc;    // número de caracteres abaixo do nó
+  int tamb;    // número de bytes abaixo do nó
+  int altura;  // 0 nas folhas
+  str folha;   // o texto, nas folhas
+};
+
+struct rope {
+  no_rope *raiz; // NULL se a corda estiver vazia
+};
+
+// funções auxiliares {{{1
+
+static int menor(int a, int b)
+{
+  return a < b ? a : b;
+}
+
+static bool rp_eh_folha(no_rope *no)
+{
+  return no->esq == NULL;
+}
+
+static int rp_altura(no_rope *no)
+{
+  return no == NULL ? -1 : no->altura;
+}
+
+// altera a posição em *ppos para que esteja dentro dos limites de lim
+//   caracteres (como em str.c)
+static void rp_ajeita_pos(int *ppos, int lim)
+{
+  if (*ppos < 0) *ppos += lim;
+  if (*ppos < 0) *ppos = 0;
+  if (*ppos > lim) *ppos = lim;
+}
+
+// altera a posição e o tamanho de um trecho para que esteja dentro dos
+//   limites de lim caracteres (como em str.c)
+static void rp_ajeita_pos_tam(int *ppos, int *ptam, int lim)
+{
+  if (*ppos < 0) *ppos += lim;
+  if (*ppos < 0) {
+    *ptam += *ppos;
+    *ppos = 0;
+  }
+  if (*ppos > lim) *ppos = lim;
+  if (*ppos + *ptam > lim) *ptam = lim - *ppos;
+  if (*ptam < 0) *ptam = 0;
+}
+
+// recalcula os tamanhos de uma folha, depois de alterado seu texto
+static void rp_atualiza_folha(no_rope *no)
+{
+  no->tamc = no->folha.tamc;
+  no->tamb = no->folha.tamb;
+}
+
+// recalcula os dados de um nó interno a partir dos filhos
+static void rp_atualiza(no_rope *no)
+{
+  no->tamc = no->esq->tamc + no->dir->tamc;
+  no->tamb = no->esq->tamb + no->dir->tamb;
+  no->altura = 1 + (no->esq->altura > no->dir->altura ? no->esq->altura
+                                                      : no->dir->altura);
+}
+
+// cria uma folha com o texto em cad, que passa a pertencer à folha
+static no_rope *rp_cria_folha(str cad)
+{
+  no_rope *no = malloc(sizeof(*no));
+  assert(no != NULL);
+  *no = (no_rope){ .esq = NULL, .dir = NULL, .altura = 0, .folha = cad };
+  rp_atualiza_folha(no);
+  return no;
+}
+
+// cria um nó interno com os filhos esq e dir
+static no_rope *rp_cria_no(no_rope *esq, no_rope *dir)
+{
+  no_rope *no = malloc(sizeof(*no));
+  assert(no != NULL);
+  *no = (no_rope){ .esq = esq, .dir = dir };
+  rp_atualiza(no);
+  return no;
+}
+
+// destrói a árvore com raiz em no
+static void rp_destroi_arvore(no_rope *no)
+{
+  if (no == NULL) return;
+  if (rp_eh_folha(no)) {
+    s_destroi(no->folha);
+  } else {
+    rp_destroi_arvore(no->esq);
+    rp_destroi_arvore(no->dir);
+  }
+  free(no);
+}
+
+// rotações da árvore; retornam a nova raiz
+static no_rope *rp_gira_dir(no_rope *no)
+{
+  no_rope *esq = no->esq;
+  no->esq = esq->dir;
+  rp_atualiza(no);
+  esq->dir = no;
+  rp_atualiza(esq);
+  return esq;
+}
+
+static no_rope *rp_gira_esq(no_rope *no)
+{
+  no_rope *dir = no->dir;
+  no->dir = dir->esq;
+  rp_atualiza(no);
+  dir->esq = no;
+  rp_atualiza(dir);
+  return dir;
+}
+
+// recalcula no, cujos filhos podem ter alturas que diferem de até 2, e
+//   refaz o balanceamento; retorna a nova raiz
+static no_rope *rp_balanceia(no_rope *no)
+{
+  rp_atualiza(no);
+  int dif = no->esq->altura - no->dir->altura;
+  if (dif > 1) {
+    if (rp_altura(no->esq->esq) < rp_altura(no->esq->dir)) {
+      no->esq = rp_gira_esq(no->esq);
+    }
+    return rp_gira_dir(no);
+  }
+  if (dif < -1) {
+    if (rp_altura(no->dir->dir) < rp_altura(no->dir->esq)) {
+      no->dir = rp_gira_dir(no->dir);
+    }
+    return rp_gira_esq(no);
+  }
+  return no;
+}
+
+// retorna a árvore com o texto de esq seguido do de dir
+// desce pelo lado da árvore mais alta até achar uma subárvore da altura da
+//   outra, e rebalanceia na volta; duas folhas que cabem em uma são unidas
+static no_rope *rp_junta(no_rope *esq, no_rope *dir)
+{
+  if (esq == NULL) return dir;
+  if (dir == NULL) return esq;
+  if (rp_eh_folha(esq) && rp_eh_folha(dir) && esq->tamb + dir->tamb <= MAX_FOLHA) {
+    s_cat(&esq->folha, dir->folha);
+    rp_atualiza_folha(esq);
+    rp_destroi_arvore(dir);
+    return esq;
+  }
+  if (esq->altura > dir->altura + 1) {
+    esq->dir = rp_junta(esq->dir, dir);
+    return rp_balanceia(esq);
+  }
+  if (dir->altura > esq->altura + 1) {
+    dir->esq = rp_junta(esq, dir->esq);
+    return rp_balanceia(dir);
+  }
+  return rp_cria_no(esq, dir);
+}
+
+// divide a árvore no antes do caractere na posição pos (entre 0 e no->tamc),
+//   colocando em *pesq a árvore com o texto antes de pos e em *pdir a com o
+//   texto a partir de pos
+// os nós internos no caminho até pos são liberados
+static void rp_divide(no_rope *no, int pos, no_rope **pesq, no_rope **pdir)
+{
+  if (no == NULL || pos == 0) {
+    *pesq = NULL;
+    *pdir = no;
+    return;
+  }
+  if (pos == no->tamc) {
+    *pesq = no;
+    *pdir = NULL;
+    return;
+  }
+  if (rp_eh_folha(no)) {
+    *pdir = rp_cria_folha(s_copia(s_sub(no->folha, pos, no->tamc - pos)));
+    s_remove(&no->folha, pos, no->tamc - pos);
+    rp_atualiza_folha(no);
+    *pesq = no;
+    return;
+  }
+  no_rope *esq = no->esq;
+  no_rope *dir = no->dir;
+  free(no);
+  no_rope *meio;
+  if (pos <= esq->tamc) {
+    rp_divide(esq, pos, pesq, &meio);
+    *pdir = rp_junta(meio, dir);
+  } else {
+    rp_divide(dir, pos - esq->tamc, &meio, pdir);
+    *pesq = rp_junta(esq, meio);
+  }
+}
+
+// retorna uma árvore balanceada com as nfolhas folhas em folhas
+static no_rope *rp_constroi_arvore(no_rope **folhas, int nfolhas)
+{
+  if (nfolhas == 1) return folhas[0];
+  int meio = nfolhas / 2;
+  return rp_cria_no(rp_constroi_arvore(folhas, meio),
+                    rp_constroi_arvore(folhas + meio, nfolhas - meio));
+}
+
+// retorna uma árvore com uma cópia do texto de cad, em folhas de cerca de
+//   TAM_FOLHA bytes (uma folha só, se couber)
+static no_rope *rp_constroi(str cad)
+{
+  if (cad.tamc == 0) return NULL;
+  // todas as folhas menos a última têm pelo menos TAM_FOLHA - 3 bytes
+  no_rope **folhas = malloc((cad.tamb / (TAM_FOLHA - 3) + 1) * sizeof(*folhas));
+  assert(folhas != NULL);
+  int nfolhas = 0;
+  byte *ptr = cad.mem;
+  byte *fim = cad.mem + cad.tamb;
+  while (ptr < fim) {
+    int nbytes = fim - ptr;
+    if (nbytes > MAX_FOLHA) {
+      nbytes = TAM_FOLHA;
+      // não corta um caractere no meio
+      while ((ptr[nbytes] & 0xC0) == 0x80) nbytes--;
+    }
+    int nchars = u8_conta_unichar_sem_verificar(ptr, nbytes);
+    folhas[nfolhas++] = rp_cria_folha(s_copia(s_cria_buf(ptr, nbytes, nchars)));
+    ptr += nbytes;
+  }
+  no_rope *raiz = rp_constroi_arvore(folhas, nfolhas);
+  free(folhas);
+  return raiz;
+}
+
+// retorna a folha que contém o caractere na posição pos da árvore no, e
+//   coloca em *ppos_folha a posição dele na folha
+// pos pode ser no->tamc (a posição após o final, na última folha); uma
+//   posição no limite entre duas folhas fica no início da segunda
+static no_rope *rp_acha_folha(no_rope *no, int pos, int *ppos_folha)
+{
+  while (!rp_eh_folha(no)) {
+    if (pos < no->esq->tamc) {
+      no = no->esq;
+    } else {
+      pos -= no->esq->tamc;
+      no = no->dir;
+    }
+  }
+  *ppos_folha = pos;
+  return no;
+}
+
+// soma dc caracteres e db bytes aos nós internos no caminho da raiz até a
+//   folha que contém pos (o mesmo caminho de rp_acha_folha)
+// deve ser chamada antes de alterar a folha
+static void rp_soma_no_caminho(no_rope *no, int pos, int dc, int db)
+{
+  while (!rp_eh_folha(no)) {
+    no->tamc += dc;
+    no->tamb += db;
+    if (pos < no->esq->tamc) {
+      no = no->esq;
+    } else {
+      pos -= no->esq->tamc;
+      no = no->dir;
+    }
+  }
+}
+
+// concatena a *pcad tam caracteres do texto da árvore no, a partir de pos
+static void rp_copia_trecho(no_rope *no, int pos, int tam, str *pcad)
+{
+  if (tam == 0) return;
+  if (rp_eh_folha(no)) {
+    s_cat(pcad, s_sub(no->folha, pos, tam));
+    return;
+  }
+  int tam_esq = no->esq->tamc;
+  if (pos < tam_esq) {
+    int n = menor(tam, tam_esq - pos);
+    rp_copia_trecho(no->esq, pos, n, pcad);
+    pos += n;
+    tam -= n;
+  }
+  if (tam > 0) rp_copia_trecho(no->dir, pos - tam_esq, tam, pcad);
+}
+
+
+// operações de criação e destruição {{{1
+
+Rope rp_cria(void)
+{
+  Rope self = malloc(sizeof(*self));
+  assert(self != NULL);
+  self->raiz = NULL;
+  return self;
+}
+
+Rope rp_de_str(str cad)
+{
+  Rope self = rp_cria();
+  if (cad.tamc == 0) {
+    s_destroi(cad);
+  } else if (cad.tamb <= MAX_FOLHA && cad.cap != 0 && cad.origem != s_mem_emprestada) {
+    // a string vira a folha
+    self->raiz = rp_cria_folha(cad);
+  } else {
+    self->raiz = rp_constroi(cad);
+    s_destroi(cad);
+  }
+  return self;
+}
+
+str rp_para_str(Rope self)
+{
+  no_rope *raiz = self->raiz;
+  free(self);
+  if (raiz != NULL && rp_eh_folha(raiz)) {
+    // a folha vira a string
+    str cad = raiz->folha;
+    free(raiz);
+    return cad;
+  }
+  str cad = s_copia(s_(""));
+  if (raiz != NULL) {
+    rp_copia_trecho(raiz, 0, raiz->tamc, &cad);
+    rp_destroi_arvore(raiz);
+  }
+  return cad;
+}
+
+void rp_destroi(Rope self)
+{
+  rp_destroi_arvore(self->raiz);
+  free(self);
+}
+
+
+// operações de acesso {{{1
+
+int rp_tam(Rope self)
+{
+  return self->raiz == NULL ? 0 : self->raiz->tamc;
+}
+
+int rp_tamb(Rope self)
+{
+  return self->raiz == NULL ? 0 : self->raiz->tamb;
+}
+
+unichar rp_ch(Rope self, int pos)
+{
+  int tam = rp_tam(self);
+  if (pos < 0) pos += tam;
+  if (pos < 0 || pos >= tam) return UNI_INV;
+  int pos_folha;
+  no_rope *folha = rp_acha_folha(self->raiz, pos, &pos_folha);
+  return s_ch(folha->folha, pos_folha);
+}
+
+str rp_sub(Rope self, int pos, int tam)
+{
+  rp_ajeita_pos_tam(&pos, &tam, rp_tam(self));
+  str cad = s_copia(s_(""));
+  rp_copia_trecho(self->raiz, pos, tam, &cad);
+  return cad;
+}
+
+
+// operações de alteração {{{1
+
+void rp_insere(Rope self, int pos, str cad)
+{
+  rp_ajeita_pos(&pos, rp_tam(self));
+  if (cad.tamc == 0) return;
+  if (self->raiz != NULL) {
+    int pos_folha;
+    no_rope *folha = rp_acha_folha(self->raiz, pos, &pos_folha);
+    if (folha->tamb + cad.tamb <= MAX_FOLHA) {
+      // cabe na folha: insere nela e corrige os tamanhos no caminho
+      rp_soma_no_caminho(self->raiz, pos, cad.tamc, cad.tamb);
+      s_insere(&folha->folha, pos_folha, cad);
+      rp_atualiza_folha(folha);
+      return;
+    }
+  }
+  // não cabe: divide a árvore em pos e junta com as folhas novas no meio
+  no_rope *esq, *dir;
+  rp_divide(self->raiz, pos, &esq, &dir);
+  self->raiz = rp_junta(rp_junta(esq, rp_constroi(cad)), dir);
+}
+
+void rp_remove(Rope self, int pos, int tam)
+{
+  rp_ajeita_pos_tam(&pos, &tam, rp_tam(self));
+  if (tam == 0) return;
+  int pos_folha;
+  no_rope *folha = rp_acha_folha(self->raiz, pos, &pos_folha);
+  if (pos_folha + tam <= folha->tamc && tam < folha->tamc) {
+    // está dentro de uma folha, que não fica vazia: remove dela e corrige
+    //   os tamanhos no caminho
+    int nbytes = s_sub(folha->folha, pos_folha, tam).tamb;
+    rp_soma_no_caminho(self->raiz, pos, -tam, -nbytes);
+    s_remove(&folha->folha, pos_folha, tam);
+    rp_atualiza_folha(folha);
+    return;
+  }
+  // divide a árvore antes e depois do trecho, e junta o que sobra
+  no_rope *esq, *meio, *dir;
+  rp_divide(self->raiz, pos, &esq, &dir);
+  rp_divide(dir, tam, &meio, &dir);
+  rp_destroi_arvore(meio);
+  self->raiz = rp_junta(esq, dir);
+}
+
+// vim: foldmethod=marker shiftwidth=2
@@ -0,0 +1,87 @@
+#ifndef _ROPE_H_
+#define _ROPE_H_
+
+// Corda de caracteres (rope)
+//
+// TAD que implementa uma string longa como uma árvore balanceada de pedaços
+//   (folhas), cada um uma str curta. Serve para strings muito longas que são
+//   alteradas no meio (uma linha de centenas de megabytes sendo editada, por
+//   exemplo), onde inserir ou remover em uma str teria que mover todo o
+//   restante da string, e chegar a uma posição teria que percorrer a string
+//   desde o início.
+//
+
+// declarações {{{1
+
+// rope é o tipo de dados para nossas cordas
+// a estrutura rope é opaca (definida em rope.c, usuários não têm acesso)
+// todas operações são realizadas por referências a corda (por isso o tipo
+//   Rope é um ponteiro para a estrutura)
+typedef struct rope *Rope;
+
+// todas as operações são implementadas por funções prefixadas por `rp_`.
+// O primeiro argumento dessas funções (exceto as de criação) é a corda
+//   objeto da operação, obtida por uma chamada a `rp_cria` ou `rp_de_str`
+//   e que ainda não foi utilizada em uma chamada a `rp_destroi` ou
+//   `rp_para_str`.
+//
+// cada nó da árvore guarda o número de caracteres e de bytes abaixo dele;
+//   o acesso a uma posição, a inserção e a remoção descem da raiz até a
+//   folha que contém a posição, com custo proporcional à altura da árvore
+//   (logarítmica no tamanho da corda) mais o tamanho de uma folha.
+//
+// o argumento `pos` segue a mesma convenção das funções de str: é a
+//   posição de um caractere, e valores negativos contam a partir do final.
+
+#include "str.h"
+
+// operações de criação e destruição {{{1
+
+// cria e retorna uma corda vazia
+Rope rp_cria(void);
+
+// cria e retorna uma corda com o conteúdo de cad
+// se cad for alterável, passa a pertencer à corda, e não deve mais ser usada
+//   nem destruída por quem chamou; se couber em uma folha, vira a folha sem
+//   ser copiada
+Rope rp_de_str(str cad);
+
+// retorna uma string alterável com o conteúdo da corda, e destrói a corda
+// se a corda tiver uma folha só, a folha é retornada, sem cópia
+str rp_para_str(Rope self);
+
+// destrói a corda
+// essa corda não deve ser utilizada após essa chamada
+void rp_destroi(Rope self);
+
+
+// operações de acesso {{{1
+
+// retorna o número de caracteres na corda
+int rp_tam(Rope self);
+
+// retorna o número de bytes na corda
+int rp_tamb(Rope self);
+
+// retorna o valor do caractere na posição pos
+// retorna UNI_INV se pos for fora dos limites da corda
+unichar rp_ch(Rope self, int pos);
+
+// retorna uma string alterável (que deve ser destruída) com a cópia dos tam
+//   caracteres a partir da posição pos
+// pos e tam são ajustados aos limites da corda como em s_sub
+str rp_sub(Rope self, int pos, int tam);
+
+
+// operações de alteração {{{1
+
+// insere o conteúdo de cad antes do caractere na posição pos
+// pos pode ser o tamanho da corda, para inserir no final
+void rp_insere(Rope self, int pos, str cad);
+
+// remove tam caracteres a partir da posição pos
+// pos e tam são ajustados aos limites da corda como em s_sub
+void rp_remove(Rope self, int pos, int tam);
+
+#endif // _ROPE_H_
+// vim: foldmethod=marker shiftwidth=2
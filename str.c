@@ -5,10 +5,72 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define S_SIMD_SSE2
+#include <emmintrin.h>
+#endif
 
 #define MIN_ALLOC 8    // alocação mínima
-
-#define STR_VAZIA (str){0,0,0,NULL}
+#define MAX_ALLOC (1 << 30) // maior alocação que segue a regra (potência de 2 em um int)
+#define TAM_BLOCO_LEITURA (1 << 20) // tamanho dos blocos lidos de arquivos
+#define TAM_LOTE_IOV 1024 // número de trechos gravados em cada writev
+#define TAM_PARTE_CONVERSAO (64 << 10) // bytes convertidos de cada vez na gravação
+#define MAX_LINKS 40 // links simbólicos seguidos até o arquivo a gravar
+
+#define STR_VAZIA (str){0,0,0,s_mem_alocada,NULL,NULL}
+
+// índice de posições de caracteres
+#define PASSO_INDICE 64   // número de caracteres entre duas entradas do índice
+#define MIN_INDICE 1024   // strings com menos caracteres não têm índice
+
+// ender[i] é a posição em bytes do caractere na posição i * PASSO_INDICE;
+//   só as nvalidos primeiras entradas estão corretas
+struct s_indice {
+  int nvalidos;   // número de entradas válidas
+  int cap;        // número de entradas alocadas em ender
+  unsigned *ender;
+};
+
+// arena
+#define TAM_BLOCO_ARENA (64 << 10) // tamanho normal dos blocos de uma arena
+#define ALINHAMENTO_ARENA 16       // alinhamento das alocações na arena
+
+// um bloco de memória de uma arena; a memória livre é a partir de livre
+struct s_bloco_arena {
+  struct s_bloco_arena *prox;
+  int livre;    // posição do primeiro byte livre em mem
+  int tam;      // número de bytes em mem
+  _Alignas(ALINHAMENTO_ARENA) byte mem[];
+};
+
+struct s_arena {
+  struct s_bloco_arena *blocos; // o primeiro é o que recebe as alocações
+};
+
+// string com lacuna
+// o conteúdo está em cad.mem, com a lacuna entre os bytes posb e
+//   posb + cap - 1 - tamb; o último byte de mem fica para o \0 do
+//   fechamento; cad.tamc e cad.tamb são os tamanhos do conteúdo
+struct s_lacuna {
+  str cad;
+  int posc;     // posição (em caracteres) da lacuna
+  int posb;     // posição (em bytes) do início da lacuna
+  int pos_min;  // menor posição que a lacuna ocupou (os caracteres antes
+                //   dela não mudaram de lugar)
+};
+
+// política e contadores de alocação
+static s_politica_t s_pol = S_POLITICA_PADRAO;
+static s_estatisticas_t s_est;
 
 // funções auxiliares {{{1
 
@@ -26,10 +88,15 @@ static void s_ok(str cad)
   if (cad.tamc > 0) {
     assert(cad.mem != NULL);
   }
+  if (cad.cap == 0) assert(cad.ind == NULL);
   if (cad.cap > 0) {
     assert(cad.mem != NULL);
     assert(cad.cap > cad.tamb);
     assert(cad.mem[cad.tamb] == '\0');
+  }
+  if (cad.origem == s_mem_mapeada) assert(cad.cap == 0);
+  else if (cad.origem != s_mem_alocada) assert(cad.cap > 0);
+  if (cad.cap > 0 && cad.origem == s_mem_alocada) {
     assert(cad.cap >= MIN_ALLOC);
     assert(pot2(cad.cap));
   }
@@ -41,11 +108,102 @@ static bool s_alteravel(str *pcad)
   return pcad->cap > 0;
 }
 
+// verifica se a memória da string apontada por pcad foi alocada por ela
+static bool s_mem_propria(str *pcad)
+{
+  return pcad->cap > 0 && pcad->origem != s_mem_emprestada;
+}
+
+// altera o número de bytes de *pcad, mantendo a contagem dos bytes usados
+static void s_muda_tamb(str *pcad, unsigned int tamb)
+{
+  if (s_mem_propria(pcad)) s_est.bytes_usados += (long long)tamb - pcad->tamb;
+  pcad->tamb = tamb;
+}
+
+// libera a memória de cad, se for dela
+static void s_libera_mem(str cad)
+{
+  if (!s_mem_propria(&cad)) return;
+  s_est.liberacoes++;
+  s_est.bytes_alocados -= cad.cap;
+  s_est.bytes_usados -= cad.tamb + 1;
+  free(cad.mem);
+}
+
+// verifica se a string só tem caracteres ASCII
+// nesse caso, cada caractere tem um byte, e a posição de um caractere é
+//   igual à posição do seu byte; as alterações mantêm tamc e tamb, então
+//   essa informação está sempre atualizada
+static bool s_ascii(str cad)
+{
+  return cad.tamc == cad.tamb;
+}
+
+// invalida as entradas do índice de *pcad para caracteres após pos, depois
+//   de uma alteração a partir dessa posição
+// cria ou destrói o índice, de acordo com o tamanho da string
+static void s_indice_invalida(str *pcad, int pos)
+{
+  if (!s_alteravel(pcad)) return;
+  struct s_indice *ind = pcad->ind;
+  // strings ASCII não precisam de índice
+  if (pcad->tamc < MIN_INDICE || s_ascii(*pcad)) {
+    if (ind != NULL) {
+      free(ind->ender);
+      free(ind);
+      pcad->ind = NULL;
+    }
+    return;
+  }
+  if (ind == NULL) {
+    ind = malloc(sizeof(*ind));
+    assert(ind != NULL);
+    ind->nvalidos = 0;
+    ind->cap = 0;
+    ind->ender = NULL;
+    pcad->ind = ind;
+  }
+  // a entrada i continua válida se o caractere dela não está após pos
+  int nvalidos = pos / PASSO_INDICE + 1;
+  if (ind->nvalidos > nvalidos) ind->nvalidos = nvalidos;
+}
+
+// retorna o endereço do caractere na posição pos de cad, usando o índice,
+//   completando as entradas que faltam até essa posição
+static byte *s_indice_ender(str cad, int pos)
+{
+  struct s_indice *ind = cad.ind;
+  int i = pos / PASSO_INDICE;
+  if (i >= ind->nvalidos) {
+    if (i >= ind->cap) {
+      int cap = cad.tamc / PASSO_INDICE + 1;
+      ind->ender = realloc(ind->ender, cap * sizeof(unsigned));
+      assert(ind->ender != NULL);
+      ind->cap = cap;
+    }
+    if (ind->nvalidos == 0) {
+      ind->ender[0] = 0;
+      ind->nvalidos = 1;
+    }
+    byte *fim = cad.mem + cad.tamb;
+    byte *ptr = cad.mem + ind->ender[ind->nvalidos - 1];
+    while (ind->nvalidos <= i) {
+      ptr = u8_avanca_unichar_sem_verificar(ptr, fim - ptr, PASSO_INDICE);
+      ind->ender[ind->nvalidos++] = ptr - cad.mem;
+    }
+  }
+  byte *ptr = cad.mem + ind->ender[i];
+  return u8_avanca_unichar_sem_verificar(ptr, cad.mem + cad.tamb - ptr,
+                                         pos - i * PASSO_INDICE);
+}
+
 // operações de criação e destruição {{{1
 
 str s_cria_buf(byte *buf, int nbytes, int nchars)
 {
-  return (str){ .tamc = nchars, .tamb = nbytes, .cap = 0, .mem = buf };
+  return (str){ .tamc = nchars, .tamb = nbytes, .cap = 0, .origem = s_mem_alocada,
+                .mem = buf, .ind = NULL };
 }
 
 str s_cria(char *strC)
@@ -61,7 +219,68 @@ str s_cria(char *strC)
 void s_destroi(str cad)
 {
   s_ok(cad);
-  if (cad.cap > 0) free(cad.mem);
+  if (cad.ind != NULL) {
+    free(cad.ind->ender);
+    free(cad.ind);
+  }
+  s_libera_mem(cad);
+}
+
+
+// arenas {{{1
+
+s_arena *s_arena_cria(void)
+{
+  s_arena *arena = malloc(sizeof(*arena));
+  assert(arena != NULL);
+  arena->blocos = NULL;
+  return arena;
+}
+
+void s_arena_destroi(s_arena *arena)
+{
+  struct s_bloco_arena *bloco = arena->blocos;
+  while (bloco != NULL) {
+    struct s_bloco_arena *prox = bloco->prox;
+    free(bloco);
+    bloco = prox;
+  }
+  free(arena);
+}
+
+void *s_arena_aloca(s_arena *arena, int nbytes)
+{
+  nbytes = (nbytes + ALINHAMENTO_ARENA - 1) & ~(ALINHAMENTO_ARENA - 1);
+  struct s_bloco_arena *bloco = arena->blocos;
+  if (bloco == NULL || bloco->tam - bloco->livre < nbytes) {
+    // alocações grandes ganham um bloco só para elas, que vai depois do
+    //   bloco atual, para não desperdiçar o que sobra nele
+    int tam = TAM_BLOCO_ARENA;
+    bool grande = nbytes > TAM_BLOCO_ARENA / 4;
+    if (grande) tam = nbytes;
+    struct s_bloco_arena *novo = malloc(sizeof(*novo) + tam);
+    assert(novo != NULL);
+    novo->livre = 0;
+    novo->tam = tam;
+    if (grande && bloco != NULL) {
+      novo->prox = bloco->prox;
+      bloco->prox = novo;
+    } else {
+      novo->prox = bloco;
+      arena->blocos = novo;
+    }
+    bloco = novo;
+  }
+  void *ptr = bloco->mem + bloco->livre;
+  bloco->livre += nbytes;
+  return ptr;
+}
+
+str s_copia_em(s_arena *arena, str cad)
+{
+  // usa também os bytes que sobrariam pelo alinhamento
+  int cap = (cad.tamb + ALINHAMENTO_ARENA) & ~(ALINHAMENTO_ARENA - 1);
+  return s_copia_buf(cad, s_arena_aloca(arena, cap), cap);
 }
 
 
@@ -81,10 +300,32 @@ char *s_mem(str cad)
 
 // retorna o endereço do byte onde inicia o caractere na posição pos de cad
 // versão sem medo -- pos está dentro dos limites válidos para cad
+// usa o índice, se a string tiver; senão, percorre a string a partir do
+//   início ou do final, o que estiver mais perto
 static byte *s_ender_pos_sm(str cad, int pos)
 {
-  if (pos == cad.tamc) return cad.mem + cad.tamb;
-  return u8_avanca_unichar(cad.mem, pos);
+  if (s_ascii(cad)) return cad.mem + pos;
+  if (cad.ind != NULL && pos >= PASSO_INDICE) return s_indice_ender(cad, pos);
+  if (pos > cad.tamc / 2) {
+    return u8_recua_unichar(cad.mem + cad.tamb, cad.tamb, cad.tamc - pos);
+  }
+  return u8_avanca_unichar_sem_verificar(cad.mem, cad.tamb, pos);
+}
+
+// retorna o endereço do byte onde inicia o caractere na posição pos de cad,
+//   sabendo que o caractere na posição pos_ref inicia em end_ref
+// percorre a partir de end_ref ou do final da string, o que estiver mais perto
+//   (ou usa o índice, se estiver longe)
+// versão sem medo -- pos_ref <= pos <= cad.tamc
+static byte *s_ender_pos_apos_sm(str cad, int pos, int pos_ref, byte *end_ref)
+{
+  byte *end_fim = cad.mem + cad.tamb;
+  if (s_ascii(cad)) return cad.mem + pos;
+  if (cad.ind != NULL && pos - pos_ref > PASSO_INDICE) return s_indice_ender(cad, pos);
+  if (pos - pos_ref > cad.tamc - pos) {
+    return u8_recua_unichar(end_fim, end_fim - cad.mem, cad.tamc - pos);
+  }
+  return u8_avanca_unichar_sem_verificar(end_ref, end_fim - end_ref, pos - pos_ref);
 }
 
 unichar s_ch(str cad, int pos)
@@ -93,6 +334,7 @@ unichar s_ch(str cad, int pos)
   // o ajuste de pos é diferente nesta função, porque tem que retornar UNI_INV
   if (pos < 0) pos += cad.tamc;
   if (pos < 0 || pos >= cad.tamc) return UNI_INV;
+  if (s_ascii(cad)) return cad.mem[pos];
   // acha e converte o caractere
   byte *ptr = s_ender_pos_sm(cad, pos);
   int nbytes_pulados = ptr - cad.mem;
@@ -105,8 +347,9 @@ unichar s_ch(str cad, int pos)
 static str s_sub_sm(str cad, int pos, int tam)
 {
   byte *end_ini = s_ender_pos_sm(cad, pos);
-  byte *end_fim = u8_avanca_unichar(end_ini, tam);
-  return (str){ .tamc = tam, .tamb = end_fim - end_ini, .cap = 0, .mem = end_ini };
+  byte *end_fim = s_ender_pos_apos_sm(cad, pos + tam, pos, end_ini);
+  return (str){ .tamc = tam, .tamb = end_fim - end_ini, .cap = 0, .origem = s_mem_alocada,
+                .mem = end_ini, .ind = NULL };
 }
 
 // altera a posição em *ppos para que dentro dos limites de lim caracteres
@@ -138,6 +381,8 @@ static void s_ajeita_pos_tam(int *ppos, int *ptam, int lim)
   if (*ppos + *ptam > lim) {
     *ptam = lim - *ppos;
   }
+  // se termina antes do início (ou tam é negativo), não sobra nada
+  if (*ptam < 0) *ptam = 0;
 }
 
 str s_sub(str cad, int pos, int tam)
@@ -156,84 +401,166 @@ str s_apara(str cad, str sobras)
 
 // operações de busca {{{1
 
-int s_busca_c(str cad, int pos, str chs)
+// busca para a frente, a partir de pos, o primeiro caractere de cad que
+//   pertence (ou não) a chs
+// chs é convertido uma vez em um conjunto, e cad é percorrida uma única vez
+static int s_busca_conjunto(str cad, int pos, str chs, bool pertence)
 {
   s_ok(cad);
   s_ok(chs);
   s_ajeita_pos(&pos, cad.tamc);
   if (chs.tamc == 0) return pos;
   if (cad.tamc == 0) return -1;
-  // extrai uma substring com cada caractere e procura em chs
-  for (int i = pos; i < cad.tamc; i++) {
-    str ch = s_sub_sm(cad, i, 1);
-    if (s_busca_s(chs, 0, ch) != -1) return i;
-  }
-  return -1;
+  u8_conjunto_t conj;
+  u8_conjunto_inicia(&conj, chs.mem, chs.tamb);
+  byte *end_ini = s_ender_pos_sm(cad, pos);
+  byte *achou = u8_busca_conjunto(end_ini, cad.mem + cad.tamb - end_ini,
+                                  &conj, pertence);
+  u8_conjunto_libera(&conj);
+  if (achou == NULL) return -1;
+  if (s_ascii(cad)) return achou - cad.mem;
+  return pos + u8_conta_unichar_sem_verificar(end_ini, achou - end_ini);
 }
 
-int s_busca_nc(str cad, int pos, str chs)
+// busca para trás, a partir de pos, o último caractere de cad que pertence
+//   (ou não) a chs
+static int s_busca_conjunto_r(str cad, int pos, str chs, bool pertence)
 {
   s_ok(cad);
   s_ok(chs);
   s_ajeita_pos(&pos, cad.tamc);
   if (chs.tamc == 0) return pos;
   if (cad.tamc == 0) return -1;
-  // extrai uma substring com cada caractere e procura em chs
-  for (int i = pos; i < cad.tamc; i++) {
-    str ch = s_sub_sm(cad, i, 1);
-    if (s_busca_s(chs, 0, ch) == -1) return i;
-  }
-  return -1;
+  // não tem caractere na posição após o último
+  if (pos == cad.tamc) pos--;
+  u8_conjunto_t conj;
+  u8_conjunto_inicia(&conj, chs.mem, chs.tamb);
+  byte *end_fim = s_ender_pos_sm(cad, pos + 1);
+  byte *achou = u8_busca_conjunto_r(cad.mem, end_fim - cad.mem, &conj, pertence);
+  u8_conjunto_libera(&conj);
+  if (achou == NULL) return -1;
+  if (s_ascii(cad)) return achou - cad.mem;
+  return pos + 1 - u8_conta_unichar_sem_verificar(achou, end_fim - achou);
+}
+
+int s_busca_c(str cad, int pos, str chs)
+{
+  return s_busca_conjunto(cad, pos, chs, true);
+}
+
+int s_busca_nc(str cad, int pos, str chs)
+{
+  return s_busca_conjunto(cad, pos, chs, false);
 }
 
 int s_busca_rc(str cad, int pos, str chs)
+{
+  return s_busca_conjunto_r(cad, pos, chs, true);
+}
+
+int s_busca_rnc(str cad, int pos, str chs)
+{
+  return s_busca_conjunto_r(cad, pos, chs, false);
+}
+
+int s_fim_classe(str cad, int pos, bool grande)
 {
   s_ok(cad);
-  s_ok(chs);
   s_ajeita_pos(&pos, cad.tamc);
-  if (chs.tamc == 0) return pos;
-  if (cad.tamc == 0) return -1;
-  // extrai uma substring com cada caractere e procura em chs
-  for (int i = pos; i >= 0; i--) {
-    str ch = s_sub_sm(cad, i, 1);
-    if (s_busca_s(chs, 0, ch) != -1) return i;
-  }
-  return -1;
+  byte *end_ini = s_ender_pos_sm(cad, pos);
+  int n;
+  u8_avanca_classe(end_ini, cad.mem + cad.tamb - end_ini, grande, &n);
+  return pos + n;
 }
 
-int s_busca_rnc(str cad, int pos, str chs)
+int s_inicio_classe(str cad, int pos, bool grande)
 {
   s_ok(cad);
-  s_ok(chs);
   s_ajeita_pos(&pos, cad.tamc);
-  if (chs.tamc == 0) return pos;
-  if (cad.tamc == 0) return -1;
-  // extrai uma substring com cada caractere e procura em chs
-  for (int i = pos; i >= 0; i--) {
-    str ch = s_sub_sm(cad, i, 1);
-    if (s_busca_s(chs, 0, ch) == -1) return i;
+  byte *end_fim = s_ender_pos_sm(cad, pos);
+  int n;
+  u8_recua_classe(end_fim, end_fim - cad.mem, grande, &n);
+  return pos - n;
+}
+
+#define MIN_BMH 32 // sem SSE2, agulhas a partir desse tamanho são buscadas com BMH
+
+// procura agulha (com pelo menos 2 bytes) em palheiro, comparando o primeiro,
+//   o do meio e o último byte da agulha com 16 posições do palheiro de cada
+//   vez; só as posições onde os três são iguais são comparadas por inteiro
+//   (com só dois bytes, agulhas que começam e terminam com espaço geram
+//   candidatos demais)
+// sem SSE2, usa memchr para achar as posições com o primeiro byte
+static byte *busca_bytes_filtro(int tam_agulha, byte agulha[tam_agulha],
+                                int tam_palheiro, byte palheiro[tam_palheiro])
+{
+  int ult = tam_agulha - 1;
+  int lim = tam_palheiro - tam_agulha; // última posição onde pode estar
+  int i = 0;
+#ifdef S_SIMD_SSE2
+  __m128i primeiro = _mm_set1_epi8(agulha[0]);
+  __m128i ultimo = _mm_set1_epi8(agulha[ult]);
+  int meio = ult / 2;
+  __m128i do_meio = _mm_set1_epi8(agulha[meio]);
+  for (; i + 15 <= lim; i += 16) {
+    __m128i ini = _mm_loadu_si128((__m128i *)(palheiro + i));
+    __m128i mei = _mm_loadu_si128((__m128i *)(palheiro + i + meio));
+    __m128i fim = _mm_loadu_si128((__m128i *)(palheiro + i + ult));
+    __m128i iguais = _mm_and_si128(_mm_cmpeq_epi8(ini, primeiro), _mm_cmpeq_epi8(fim, ultimo));
+    iguais = _mm_and_si128(iguais, _mm_cmpeq_epi8(mei, do_meio));
+    int candidatos = _mm_movemask_epi8(iguais);
+    while (candidatos != 0) {
+      byte *p = palheiro + i + __builtin_ctz(candidatos);
+      if (memcmp(p + 1, agulha + 1, ult - 1) == 0) return p;
+      candidatos &= candidatos - 1;
+    }
+  }
+#endif
+  while (i <= lim) {
+    byte *p = memchr(palheiro + i, agulha[0], lim - i + 1);
+    if (p == NULL) return NULL;
+    if (p[ult] == agulha[ult] && memcmp(p + 1, agulha + 1, ult - 1) == 0) return p;
+    i = p - palheiro + 1;
   }
-  return -1;
+  return NULL;
 }
 
-// retorna true se tam bytes em b1 são iguais aos em b2
-// poderia usar memcmp para isso
-static bool bytes_iguais(int tam, byte b1[tam], byte b2[tam])
+// procura agulha em palheiro com o algoritmo de Boyer-Moore-Horspool: compara
+//   o último byte da posição e, se não achar, salta de acordo com a última
+//   ocorrência desse byte na agulha (agulhas longas permitem saltos longos)
+#ifndef S_SIMD_SSE2
+static byte *busca_bytes_bmh(int tam_agulha, byte agulha[tam_agulha],
+                             int tam_palheiro, byte palheiro[tam_palheiro])
 {
-  for (int i = 0; i < tam; i++) {
-    if (b1[i] != b2[i]) return false;
+  int ult = tam_agulha - 1;
+  int salto[256];
+  for (int c = 0; c < 256; c++) salto[c] = tam_agulha;
+  for (int k = 0; k < ult; k++) salto[agulha[k]] = ult - k;
+  for (int i = 0; i <= tam_palheiro - tam_agulha; i += salto[palheiro[i + ult]]) {
+    if (palheiro[i + ult] == agulha[ult] && memcmp(palheiro + i, agulha, ult) == 0) {
+      return palheiro + i;
+    }
   }
-  return true;
+  return NULL;
 }
+#endif
 
 // procura agulha em palheiro, retorna a posição em palheiro onde está agulha, ou NULL
+// o algoritmo é escolhido pelo tamanho da agulha: com SSE2, o filtro é mais
+//   rápido que BMH para qualquer tamanho (lê o palheiro na velocidade da
+//   memória, enquanto os saltos do BMH dependem um do outro)
 static byte *busca_bytes(int tam_agulha, byte agulha[tam_agulha],
                          int tam_palheiro, byte palheiro[tam_palheiro])
 {
-  for (int i = 0; i <= tam_palheiro - tam_agulha; i++) {
-    if (bytes_iguais(tam_agulha, palheiro + i, agulha)) return palheiro + i;
+  if (tam_agulha == 0) return palheiro;
+  if (tam_agulha > tam_palheiro) return NULL;
+  if (tam_agulha == 1) return memchr(palheiro, agulha[0], tam_palheiro);
+#ifndef S_SIMD_SSE2
+  if (tam_agulha >= MIN_BMH) {
+    return busca_bytes_bmh(tam_agulha, agulha, tam_palheiro, palheiro);
   }
-  return NULL;
+#endif
+  return busca_bytes_filtro(tam_agulha, agulha, tam_palheiro, palheiro);
 }
 
 int s_busca_s(str cad, int pos, str buscada)
@@ -244,13 +571,13 @@ int s_busca_s(str cad, int pos, str buscada)
   if (pos >= cad.tamc) return -1;
   byte *end_ini = s_ender_pos_sm(cad, pos);
   byte *end_fim = cad.mem + cad.tamb;
-  // usa memmem para procurar o byte onde inicia a string buscada
-  // memmem não é padrão :(
-  // byte *end_achou = memmem(end_ini, end_fim - end_ini, buscada.mem, buscada.tamb);
+  // procura o byte onde inicia a string buscada
   byte *end_achou = busca_bytes(buscada.tamb, buscada.mem, end_fim - end_ini, end_ini);
   if (end_achou == NULL) return -1;
-  // transforma os bytes contados em caracteres
-  return pos + u8_conta_unichar_nos_bytes(end_ini, end_achou - end_ini);
+  if (s_ascii(cad)) return end_achou - cad.mem;
+  // transforma os bytes contados em caracteres (cad tem utf8 válido, não
+  //   precisa verificar)
+  return pos + u8_conta_unichar_sem_verificar(end_ini, end_achou - end_ini);
 }
 
 
@@ -262,32 +589,119 @@ int s_busca_s(str cad, int pos, str buscada)
 //   bytes, tamanho é potência de 2
 // a string é considerada alterável, mesmo que cap seja 0 (para ser usado para alocação
 //   inicial, com cap==0 e mem==NULL; realloc é igual malloc quando recebe NULL)
+// a redução só é feita quando a memória passa do limite da política
+// a memória emprestada é usada enquanto couber (nunca é encolhida), a exata
+//   enquanto couber sem passar do limite; depois disso, a string passa a
+//   seguir a regra
 static void s_realoca(str *pcad, unsigned int precisa)
 {
+  // a maior string alterável tem MAX_ALLOC - 1 bytes
+  assert(precisa < MAX_ALLOC);
+  bool sobra_demais = pcad->cap > (long long)s_pol.limite_encolhe * precisa;
+  if (pcad->origem == s_mem_emprestada) {
+    if (precisa < pcad->cap) return;
+    byte *emprestada = pcad->mem;
+    int cap_emprestada = pcad->cap;
+    pcad->mem = NULL;
+    pcad->cap = 0;
+    pcad->origem = s_mem_alocada;
+    s_est.promocoes++;
+    s_realoca(pcad, precisa);
+    memcpy(pcad->mem, emprestada, cap_emprestada);
+    return;
+  }
   int nbytes = pcad->cap;
+  if (pcad->origem == s_mem_exata) {
+    if (precisa < pcad->cap && !sobra_demais) return;
+    // o tamanho não é uma potência de 2, recomeça do mínimo
+    pcad->origem = s_mem_alocada;
+    s_est.promocoes++;
+    nbytes = MIN_ALLOC;
+  }
   if (nbytes < MIN_ALLOC) nbytes = MIN_ALLOC;
   while (nbytes <= precisa) nbytes *= 2;
-  while (nbytes > MIN_ALLOC && nbytes > 3 * precisa) nbytes /= 2;
+  if (sobra_demais) {
+    while (nbytes > MIN_ALLOC && nbytes > 3 * precisa) nbytes /= 2;
+  }
   if (nbytes != pcad->cap) {
+    if (pcad->mem == NULL) {
+      s_est.alocacoes++;
+      s_est.bytes_usados += pcad->tamb + 1;
+    } else {
+      s_est.realocacoes++;
+    }
+    s_est.bytes_alocados += nbytes - (int)pcad->cap;
     pcad->mem = realloc(pcad->mem, nbytes);
     assert(pcad->mem != NULL);
     pcad->cap = nbytes;
   }
 }
 
+// troca a memória de *pcad (que é dela, ou NULL) por uma com o tamanho
+//   exato para o conteúdo (pcad->tamb bytes mais o \0)
+static void s_realoca_exata(str *pcad)
+{
+  int nbytes = pcad->tamb + 1;
+  if (pcad->mem == NULL) {
+    s_est.alocacoes++;
+    s_est.bytes_usados += nbytes;
+  } else if (nbytes != pcad->cap) {
+    s_est.realocacoes++;
+  }
+  s_est.bytes_alocados += nbytes - (int)pcad->cap;
+  pcad->mem = realloc(pcad->mem, nbytes);
+  assert(pcad->mem != NULL);
+  pcad->cap = nbytes;
+  pcad->origem = s_mem_exata;
+}
+
+void s_define_politica(s_politica_t politica)
+{
+  if (politica.limite_encolhe < 3) politica.limite_encolhe = 3;
+  s_pol = politica;
+}
+
+s_politica_t s_politica(void)
+{
+  return s_pol;
+}
+
+s_estatisticas_t s_estatisticas(void)
+{
+  return s_est;
+}
+
 str s_copia(str cad)
 {
   s_ok(cad);
   str nova;
   nova.tamc = cad.tamc;
   nova.tamb = cad.tamb;
-  // força a alocação de acordo com as regras
+  // força a alocação de acordo com as regras (ou exata, se a política pedir)
   nova.cap = 0;
+  nova.origem = s_mem_alocada;
   nova.mem = NULL;
-  s_realoca(&nova, nova.tamb);
+  nova.ind = NULL;
+  if (s_pol.copia_exata) s_realoca_exata(&nova);
+  else s_realoca(&nova, nova.tamb);
   // copia para o novo lar, sem esquecer do \0
   memcpy(nova.mem, cad.mem, nova.tamb);
   nova.mem[nova.tamb] = '\0';
+  s_indice_invalida(&nova, 0);
+  s_ok(nova);
+  return nova;
+}
+
+str s_copia_buf(str cad, byte *buf, int cap)
+{
+  s_ok(cad);
+  assert(cap > cad.tamb);
+  str nova = s_cria_buf(buf, cad.tamb, cad.tamc);
+  nova.cap = cap;
+  nova.origem = s_mem_emprestada;
+  memcpy(nova.mem, cad.mem, nova.tamb);
+  nova.mem[nova.tamb] = '\0';
+  s_indice_invalida(&nova, 0);
   s_ok(nova);
   return nova;
 }
@@ -314,8 +728,9 @@ void s_insere(str *pcad, int pos, str cadb)
   // copia cadb para o espaço gerado
   memcpy(end_ini, cadb.mem, cadb.tamb);
   // ajusta os tamanhos
-  pcad->tamb += cadb.tamb;
+  s_muda_tamb(pcad, pcad->tamb + cadb.tamb);
   pcad->tamc += cadb.tamc;
+  s_indice_invalida(pcad, pos);
 }
 
 void s_remove(str *pcad, int pos, int tam)
@@ -326,71 +741,108 @@ void s_remove(str *pcad, int pos, int tam)
   s_ajeita_pos_tam(&pos, &tam, pcad->tamc);
   // calcula os endereços do primeiro byte a remover e do primeiro que fica
   byte *end_ini = s_ender_pos_sm(*pcad, pos);
-  byte *end_fim = u8_avanca_unichar(end_ini, tam);
+  byte *end_fim = s_ender_pos_apos_sm(*pcad, pos + tam, pos, end_ini);
   // copia o final sobre o que é removido (não esquece de copiar o \0)
   int nbytes_remocao = end_fim - end_ini;
   memmove(end_ini, end_fim, pcad->mem + pcad->tamb - end_fim + 1);
   // ajusta os tamanhos
-  pcad->tamb -= nbytes_remocao;
+  s_muda_tamb(pcad, pcad->tamb - nbytes_remocao);
   pcad->tamc -= tam;
+  s_indice_invalida(pcad, pos);
   // garante que o quantidade alocada segue as regras
   s_realoca(pcad, pcad->tamb);
 }
 
-void s_preenche(str *pcad, int tam, str enchimento)
+// retorna o número de bytes dos n primeiros caracteres de cad
+// versão sem medo -- 0 <= n <= cad.tamc
+static int s_nbytes_prefixo_sm(str cad, int n)
 {
-  s_ok(*pcad);
-  s_ok(enchimento);
-  if (!s_alteravel(pcad)) return;
-  int nchar_adicao = tam - pcad->tamc;
-  // implementação não muito otimizada...
-  while (nchar_adicao > 0) {
-    str adicao = s_sub(enchimento, 0, nchar_adicao);
-    s_cat(pcad, adicao);
-    nchar_adicao -= s_tam(adicao);
-  }
+  return s_ender_pos_sm(cad, n) - cad.mem;
 }
 
-// funções auxiliares para implementar os vários casos de s_subst
-
-// substituição antes do início da string, com enchimento, sem medo
-static void s_subst_antes_com_enchimento_sm(str *pcad, int pos, int tam, str cadb, str enchimento)
+// número de bytes de n caracteres de enchimento, repetido, começando no
+//   caractere na posição fase
+// coloca em *pnb1 o número de bytes do primeiro pedaço (de fase até o final
+//   do enchimento, ou menos se n for pequeno)
+static int s_nbytes_enchimento_sm(str enchimento, int fase, int n, int *pnb1)
 {
-  s_insere(pcad, 0, cadb);
-  int pos_adicao = s_tam(cadb);
-  // o enchimento deveria começar em pos, com tam caracteres sendo substituídos;
-  //   calcula qual seria o primeiro caractere do enchimento depois disso
-  int pos_enchimento = tam % s_tam(enchimento);
-  int n_enchimento = -(pos + tam);
-  while (n_enchimento > 0) {
-    str adicao = s_sub(enchimento, pos_enchimento, n_enchimento);
-    s_insere(pcad, pos_adicao, adicao);
-    n_enchimento -= s_tam(adicao);
-    pos_adicao += s_tam(adicao);
-    // agora enche desde o primeiro caractere do enchimento
-    pos_enchimento = 0;
-  }
+  *pnb1 = 0;
+  if (n <= 0) return 0;
+  int n1 = enchimento.tamc - fase;
+  if (n1 > n) n1 = n;
+  byte *end_fase = s_ender_pos_sm(enchimento, fase);
+  byte *end_fim1 = s_ender_pos_apos_sm(enchimento, fase + n1, fase, end_fase);
+  *pnb1 = end_fim1 - end_fase;
+  n -= n1;
+  int ncopias = n / enchimento.tamc;
+  int nresto = n % enchimento.tamc;
+  return *pnb1 + ncopias * enchimento.tamb + s_nbytes_prefixo_sm(enchimento, nresto);
 }
 
-// substituição no final da string, com enchimento, sem medo
-static void s_subst_depois_com_enchimento_sm(str *pcad, int pos, str cadb, str enchimento)
+// escreve em dest os nbytes do enchimento repetido, começando pelos nb1
+//   bytes a partir do caractere fase
+// depois do primeiro pedaço, o padrão se repete com período enchimento.tamb,
+//   e é completado copiando o que já foi escrito, dobrando a cada cópia
+static void s_escreve_enchimento_sm(byte *dest, int nbytes, str enchimento, int fase, int nb1)
 {
-  s_preenche(pcad, pos, enchimento);
-  s_cat(pcad, cadb);
+  if (nbytes == 0) return;
+  memcpy(dest, s_ender_pos_sm(enchimento, fase), nb1);
+  dest += nb1;
+  nbytes -= nb1;
+  if (nbytes == 0) return;
+  int feitos = nbytes < enchimento.tamb ? nbytes : enchimento.tamb;
+  memcpy(dest, enchimento.mem, feitos);
+  while (feitos < nbytes) {
+    int n = nbytes - feitos < feitos ? nbytes - feitos : feitos;
+    memcpy(dest + feitos, dest, n);
+    feitos += n;
+  }
 }
 
-// substitui o que tiver em pcad a partir de pos por cadb, sem medo
-static void s_subst_final_sm(str *pcad, int pos, str cadb)
+// substitui os tam caracteres de *pcad a partir de pos pela concatenação de
+//   cada, n_ench caracteres de enchimento (repetido, começando pelo caractere
+//   na posição fase) e cadb
+// calcula o tamanho final uma vez, realoca no máximo uma vez e move o final
+//   da string uma vez
+// versão sem medo -- pos e tam estão dentro dos limites de *pcad, que é
+//   alterável; 0 <= fase < s_tam(enchimento) se n_ench > 0
+static void s_emenda_sm(str *pcad, int pos, int tam, str cada,
+                        str enchimento, int fase, int n_ench, str cadb)
 {
-  s_remove(pcad, pos, s_tam(*pcad) - pos); // poderia ter s_trunca...
-  s_cat(pcad, cadb);
+  if (enchimento.tamc == 0) n_ench = 0;
+  byte *end_ini = s_ender_pos_sm(*pcad, pos);
+  byte *end_fim = s_ender_pos_apos_sm(*pcad, pos + tam, pos, end_ini);
+  int ini = end_ini - pcad->mem;
+  int nbytes_removidos = end_fim - end_ini;
+  // o final, com o \0
+  int nbytes_final = pcad->tamb + 1 - (ini + nbytes_removidos);
+  int nb1;
+  int nbytes_ench = s_nbytes_enchimento_sm(enchimento, fase, n_ench, &nb1);
+  int nbytes_novos = cada.tamb + nbytes_ench + cadb.tamb;
+  int tamb = pcad->tamb - nbytes_removidos + nbytes_novos;
+  // se aumenta, realoca antes de mover o final; se diminui, depois
+  if (nbytes_novos > nbytes_removidos) s_realoca(pcad, tamb);
+  byte *dest = pcad->mem + ini;
+  memmove(dest + nbytes_novos, dest + nbytes_removidos, nbytes_final);
+  if (cada.tamb > 0) memcpy(dest, cada.mem, cada.tamb);
+  dest += cada.tamb;
+  s_escreve_enchimento_sm(dest, nbytes_ench, enchimento, fase, nb1);
+  dest += nbytes_ench;
+  if (cadb.tamb > 0) memcpy(dest, cadb.mem, cadb.tamb);
+  s_muda_tamb(pcad, tamb);
+  pcad->tamc += cada.tamc + n_ench + cadb.tamc - tam;
+  s_indice_invalida(pcad, pos);
+  if (nbytes_novos < nbytes_removidos) s_realoca(pcad, tamb);
 }
 
-// substitui tam caracteres em pcad a partir de pos por cadb, sem medo
-static void s_subst_sm(str *pcad, int pos, int tam, str cadb)
+void s_preenche(str *pcad, int tam, str enchimento)
 {
-  s_remove(pcad, pos, tam);
-  s_insere(pcad, pos, cadb);
+  s_ok(*pcad);
+  s_ok(enchimento);
+  if (!s_alteravel(pcad)) return;
+  int nchar_adicao = tam - pcad->tamc;
+  if (nchar_adicao <= 0) return;
+  s_emenda_sm(pcad, pcad->tamc, 0, STR_VAZIA, enchimento, 0, nchar_adicao, STR_VAZIA);
 }
 
 void s_subst(str *pcad, int pos, int tam, str cadb, str enchimento)
@@ -403,7 +855,10 @@ void s_subst(str *pcad, int pos, int tam, str cadb, str enchimento)
   if (tam < 0) tam = 0; // sem suporte a tamanhos negativos
 
   if (pos + tam < 0) { // precisa de enchimento no início
-    s_subst_antes_com_enchimento_sm(pcad, pos, tam, cadb, enchimento);
+    // o enchimento deveria começar em pos, com tam caracteres sendo
+    //   substituídos; o primeiro caractere do enchimento depois disso é fase
+    int fase = enchimento.tamc > 0 ? tam % enchimento.tamc : 0;
+    s_emenda_sm(pcad, 0, 0, cadb, enchimento, fase, -(pos + tam), STR_VAZIA);
     return;
   }
 
@@ -413,22 +868,309 @@ void s_subst(str *pcad, int pos, int tam, str cadb, str enchimento)
     pos = 0;
   }
 
-  if (pos > s_tam(*pcad)) { // precisa de enchimento no final
-    s_subst_depois_com_enchimento_sm(pcad, pos, cadb, enchimento);
-  } else if (pos + tam >= s_tam(*pcad)) {
-    s_subst_final_sm(pcad, pos, cadb);
+  int tamc = s_tam(*pcad);
+  if (pos > tamc) { // precisa de enchimento no final
+    s_emenda_sm(pcad, tamc, 0, STR_VAZIA, enchimento, 0, pos - tamc, cadb);
+  } else {
+    // se termina depois do final, substitui até o final
+    if (pos + tam > tamc) tam = tamc - pos;
+    s_emenda_sm(pcad, pos, tam, cadb, enchimento, 0, 0, STR_VAZIA);
+  }
+}
+
+// converte a caixa dos caracteres da substring de *pcad em pos com tam
+//   caracteres
+static void s_altera_caixa(str *pcad, int pos, int tam, u8_caixa_t caixa)
+{
+  s_ok(*pcad);
+  if (!s_alteravel(pcad)) return;
+  s_ajeita_pos_tam(&pos, &tam, pcad->tamc);
+  byte *end_ini = s_ender_pos_sm(*pcad, pos);
+  byte *end_fim = s_ender_pos_apos_sm(*pcad, pos + tam, pos, end_ini);
+  int nbytes = end_fim - end_ini;
+  // quase sempre a conversão não muda o número de bytes, e é feita no lugar
+  int nconv = u8_altera_caixa_no_lugar(end_ini, nbytes, caixa);
+  if (nconv == nbytes) return;
+  // algum caractere muda de tamanho: converte o resto em outra memória e
+  //   substitui
+  int nchars_conv = u8_conta_unichar_sem_verificar(end_ini, nconv);
+  byte *buf = malloc((nbytes - nconv) * 3 / 2 + 1);
+  assert(buf != NULL);
+  int nbuf = u8_altera_caixa_bloco(end_ini + nconv, nbytes - nconv, buf, caixa);
+  int tam_resto = tam - nchars_conv;
+  s_emenda_sm(pcad, pos + nchars_conv, tam_resto, s_cria_buf(buf, nbuf, tam_resto),
+              STR_VAZIA, 0, 0, STR_VAZIA);
+  free(buf);
+}
+
+void s_maiuscula(str *pcad, int pos, int tam)
+{
+  s_altera_caixa(pcad, pos, tam, u8_caixa_alta);
+}
+
+void s_minuscula(str *pcad, int pos, int tam)
+{
+  s_altera_caixa(pcad, pos, tam, u8_caixa_baixa);
+}
+
+void s_alterna_caixa(str *pcad, int pos, int tam)
+{
+  s_altera_caixa(pcad, pos, tam, u8_caixa_alternada);
+}
+
+void s_normaliza(str *pcad)
+{
+  s_ok(*pcad);
+  if (!s_alteravel(pcad)) return;
+  // quase sempre a cadeia já está normalizada, e não precisa de memória extra
+  int nbytes_ok = u8_prefixo_nfc(pcad->mem, pcad->tamb);
+  if (nbytes_ok == pcad->tamb) return;
+  int nbytes_resto = pcad->tamb - nbytes_ok;
+  byte *buf = malloc(3 * nbytes_resto);
+  assert(buf != NULL);
+  int nbuf = u8_normaliza_nfc(pcad->mem + nbytes_ok, nbytes_resto, buf);
+  s_realoca(pcad, nbytes_ok + nbuf);
+  memcpy(pcad->mem + nbytes_ok, buf, nbuf);
+  free(buf);
+  s_muda_tamb(pcad, nbytes_ok + nbuf);
+  pcad->mem[pcad->tamb] = '\0';
+  int nchars_ok = u8_conta_unichar_sem_verificar(pcad->mem, nbytes_ok);
+  pcad->tamc = nchars_ok + u8_conta_unichar_sem_verificar(pcad->mem + nbytes_ok, nbuf);
+  s_indice_invalida(pcad, nchars_ok);
+}
+
+// strings com lacuna {{{1
+
+// número de bytes na lacuna
+static int s_lacuna_nbytes(s_lacuna *lac)
+{
+  return lac->cad.cap - 1 - lac->cad.tamb;
+}
+
+// muda a lacuna para a posição pos (em caracteres), movendo os bytes que
+//   estão entre a posição atual e a nova para o outro lado da lacuna
+static void s_lacuna_move(s_lacuna *lac, int pos)
+{
+  str *pcad = &lac->cad;
+  byte *lacuna = pcad->mem + lac->posb;
+  byte *depois = lacuna + s_lacuna_nbytes(lac);
+  if (pos < lac->posc) {
+    int n = lac->posc - pos;
+    byte *ini = s_ascii(*pcad) ? lacuna - n : u8_recua_unichar(lacuna, lac->posb, n);
+    int nbytes = lacuna - ini;
+    memmove(depois - nbytes, ini, nbytes);
+    lac->posb -= nbytes;
+  } else if (pos > lac->posc) {
+    int n = pos - lac->posc;
+    int nbytes_depois = pcad->tamb - lac->posb;
+    byte *fim = s_ascii(*pcad) ? depois + n
+                               : u8_avanca_unichar_sem_verificar(depois, nbytes_depois, n);
+    int nbytes = fim - depois;
+    memmove(lacuna, depois, nbytes);
+    lac->posb += nbytes;
+  }
+  lac->posc = pos;
+  if (pos < lac->pos_min) lac->pos_min = pos;
+}
+
+s_lacuna *s_lacuna_cria(str cad)
+{
+  s_ok(cad);
+  if (!s_alteravel(&cad)) cad = s_copia(cad);
+  s_lacuna *lac = malloc(sizeof(*lac));
+  assert(lac != NULL);
+  // a lacuna começa no final, onde está a sobra da memória de cad
+  lac->cad = cad;
+  lac->posc = cad.tamc;
+  lac->posb = cad.tamb;
+  lac->pos_min = cad.tamc;
+  return lac;
+}
+
+str s_lacuna_fecha(s_lacuna *lac)
+{
+  str cad = lac->cad;
+  int pos_min = lac->pos_min;
+  s_lacuna_move(lac, cad.tamc);
+  free(lac);
+  cad.mem[cad.tamb] = '\0';
+  // só o que estava depois de pos_min mudou de lugar
+  s_indice_invalida(&cad, pos_min);
+  // a lacuna pode ter deixado sobra demais
+  s_realoca(&cad, cad.tamb);
+  s_ok(cad);
+  return cad;
+}
+
+int s_lacuna_tam(s_lacuna *lac)
+{
+  return lac->cad.tamc;
+}
+
+str s_lacuna_sub(s_lacuna *lac, int pos, int tam)
+{
+  str *pcad = &lac->cad;
+  s_ajeita_pos_tam(&pos, &tam, pcad->tamc);
+  if (tam == 0) return STR_VAZIA;
+  // se o trecho tem a lacuna no meio, ela vai para o extremo mais próximo
+  if (pos < lac->posc && pos + tam > lac->posc) {
+    if (lac->posc - pos < pos + tam - lac->posc) {
+      s_lacuna_move(lac, pos);
+    } else {
+      s_lacuna_move(lac, pos + tam);
+    }
+  }
+  byte *ini;
+  byte *limite; // final da parte do conteúdo onde está o trecho
+  if (pos < lac->posc) {
+    // o trecho está antes da lacuna, anda para trás a partir dela
+    byte *lacuna = pcad->mem + lac->posb;
+    int n = lac->posc - pos;
+    ini = s_ascii(*pcad) ? lacuna - n : u8_recua_unichar(lacuna, lac->posb, n);
+    limite = lacuna;
   } else {
-    // tá tudo dentro da string
-    s_subst_sm(pcad, pos, tam, cadb);
+    // o trecho está depois da lacuna, anda para a frente a partir dela
+    byte *depois = pcad->mem + lac->posb + s_lacuna_nbytes(lac);
+    int n = pos - lac->posc;
+    int nbytes_depois = pcad->tamb - lac->posb;
+    ini = s_ascii(*pcad) ? depois + n
+                         : u8_avanca_unichar_sem_verificar(depois, nbytes_depois, n);
+    limite = pcad->mem + pcad->cap - 1;
+  }
+  byte *fim = s_ascii(*pcad) ? ini + tam
+                             : u8_avanca_unichar_sem_verificar(ini, limite - ini, tam);
+  return s_cria_buf(ini, fim - ini, tam);
+}
+
+void s_lacuna_insere(s_lacuna *lac, int pos, str cadb)
+{
+  s_ok(cadb);
+  str *pcad = &lac->cad;
+  s_ajeita_pos(&pos, pcad->tamc);
+  if (cadb.tamb == 0) return;
+  s_lacuna_move(lac, pos);
+  if (s_lacuna_nbytes(lac) < cadb.tamb) {
+    // aumenta a memória (s_realoca preserva todos os bytes da memória
+    //   antiga), e leva para o final o que está depois da lacuna
+    int cap_antiga = pcad->cap;
+    int nbytes_depois = pcad->tamb - lac->posb;
+    s_realoca(pcad, pcad->tamb + cadb.tamb);
+    memmove(pcad->mem + pcad->cap - 1 - nbytes_depois,
+            pcad->mem + cap_antiga - 1 - nbytes_depois, nbytes_depois);
   }
+  memcpy(pcad->mem + lac->posb, cadb.mem, cadb.tamb);
+  lac->posb += cadb.tamb;
+  lac->posc += cadb.tamc;
+  pcad->tamc += cadb.tamc;
+  s_muda_tamb(pcad, pcad->tamb + cadb.tamb);
 }
 
+void s_lacuna_remove(s_lacuna *lac, int pos, int tam)
+{
+  str *pcad = &lac->cad;
+  s_ajeita_pos_tam(&pos, &tam, pcad->tamc);
+  if (tam == 0) return;
+  s_lacuna_move(lac, pos);
+  // os caracteres removidos passam a fazer parte da lacuna
+  byte *depois = pcad->mem + lac->posb + s_lacuna_nbytes(lac);
+  int nbytes_depois = pcad->tamb - lac->posb;
+  byte *fim = s_ascii(*pcad) ? depois + tam
+                             : u8_avanca_unichar_sem_verificar(depois, nbytes_depois, tam);
+  pcad->tamc -= tam;
+  s_muda_tamb(pcad, pcad->tamb - (fim - depois));
+}
 
 // operações de acesso a arquivo {{{1
 
+// retorna true se cad contém um final de linha windows ("\r\n")
+static bool s_tem_crlf_sm(str cad)
+{
+  byte *fim = cad.mem + cad.tamb;
+  byte *p = cad.mem;
+  while ((p = memchr(p, '\r', fim - p)) != NULL) {
+    p++;
+    if (p < fim && *p == '\n') return true;
+  }
+  return false;
+}
+
+// retorna quantos dos nbytes em ptr, na codificação cod, formam uma parte
+//   com no máximo max bytes que não corta um caractere (nem um par de
+//   substitutos utf16)
+static int s_tam_parte(byte *ptr, int nbytes, int max, u8_codificacao_t cod)
+{
+  if (nbytes <= max) return nbytes;
+  int n = max;
+  switch (cod) {
+    case u8_cp1252:
+      break;
+    case u8_utf16le:
+    case u8_utf16be: {
+      n &= ~1;
+      // byte alto da última unidade da parte
+      byte alto = ptr[n - 2 + (cod == u8_utf16be ? 0 : 1)];
+      if (alto >= 0xD8 && alto < 0xDC) n -= 2;
+      break;
+    }
+    default:
+      // um caractere utf8 tem no máximo 3 bytes de continuação
+      for (int i = 0; i < 3 && (ptr[n] & 0xC0) == 0x80; i++) n--;
+  }
+  return n;
+}
+
+// converte o conteúdo de *pcad, na codificação cod, para utf8
+// converte em blocos, para que a memória cresça com o resultado, em vez de
+//   ser reservado de uma vez o maior tamanho possível (3 vezes o original)
+// retorna false (com errno EFBIG) se o resultado não couber em uma string;
+//   nesse caso, *pcad não é alterada
+static bool s_transcodifica_sm(str *pcad, u8_codificacao_t cod)
+{
+  str nova;
+  nova.mem = NULL;
+  nova.cap = 0;
+  nova.origem = s_mem_alocada;
+  nova.tamb = 0;
+  nova.ind = NULL;
+  byte *buf = malloc(3 * TAM_BLOCO_LEITURA);
+  assert(buf != NULL);
+  byte *ptr = pcad->mem;
+  byte *fim = pcad->mem + pcad->tamb;
+  while (ptr < fim) {
+    int nbytes = s_tam_parte(ptr, fim - ptr, TAM_BLOCO_LEITURA, cod);
+    // a marca de ordem de bytes só é removida no início
+    int n;
+    if (ptr == pcad->mem) n = u8_transcodifica(ptr, nbytes, cod, buf);
+    else n = u8_transcodifica_parte(ptr, nbytes, cod, buf);
+    if ((long long)nova.tamb + n >= MAX_ALLOC) {
+      free(buf);
+      s_libera_mem(nova);
+      errno = EFBIG;
+      return false;
+    }
+    s_realoca(&nova, nova.tamb + n);
+    memcpy(nova.mem + nova.tamb, buf, n);
+    s_muda_tamb(&nova, nova.tamb + n);
+    ptr += nbytes;
+  }
+  free(buf);
+  s_realoca(&nova, nova.tamb);
+  nova.mem[nova.tamb] = '\0';
+  s_libera_mem(*pcad);
+  *pcad = nova;
+  return true;
+}
+
 str s_le_arquivo(str nome)
+{
+  return s_le_arquivo_formato(nome, NULL);
+}
+
+str s_le_arquivo_formato(str nome, s_formato_t *pformato)
 {
   s_ok(nome);
+  // o formato dos erros e dos arquivos vazios
+  if (pformato != NULL) *pformato = (s_formato_t){ u8_utf8, false };
 
   // abre o arquivo
   FILE *arq;
@@ -436,33 +1178,169 @@ str s_le_arquivo(str nome)
   arq = fopen(nomec, "r");
   free(nomec);
   if (arq == NULL) return STR_VAZIA;
+  // um diretório pode ser aberto, mas não lido
+  struct stat st;
+  if (fstat(fileno(arq), &st) == 0 && S_ISDIR(st.st_mode)) {
+    fclose(arq);
+    errno = EISDIR;
+    return STR_VAZIA;
+  }
 
   // descobre o tamanho do arquivo
-  long tam_arq;
-  assert(fseek(arq, 0, SEEK_END) == 0);
-  tam_arq = ftell(arq);
-  assert(tam_arq >= 0);
+  // (falha em arquivos sem posição, como pipes)
+  long tam_arq = -1;
+  if (fseek(arq, 0, SEEK_END) == 0) tam_arq = ftell(arq);
+  if (tam_arq < 0) {
+    int erro = errno;
+    fclose(arq);
+    errno = erro;
+    return STR_VAZIA;
+  }
   rewind(arq);
   
   // aloca espaco e preenche com o conteúdo do arquivo
   str nova;
   nova.mem = NULL;
   nova.cap = 0;
+  nova.origem = s_mem_alocada;
+  nova.tamb = 0;
+  nova.ind = NULL;
+  if (tam_arq >= MAX_ALLOC) {
+    fclose(arq);
+    errno = EFBIG;
+    return STR_VAZIA;
+  }
   s_realoca(&nova, tam_arq);
-  int bytes_lidos = fread(nova.mem, 1, tam_arq, arq);
+  // lê em blocos, verificando a codificação de cada bloco logo após a
+  //   leitura, enquanto ele ainda está no cache
+  u8_verificador_t ver;
+  u8_verificador_inicia(&ver);
+  bool tem_cr = false;
+  int bytes_lidos = 0;
+  while (bytes_lidos < tam_arq) {
+    int bloco = tam_arq - bytes_lidos;
+    if (bloco > TAM_BLOCO_LEITURA) bloco = TAM_BLOCO_LEITURA;
+    int n = fread(nova.mem + bytes_lidos, 1, bloco, arq);
+    if (n <= 0) break;
+    u8_verificador_processa(&ver, nova.mem + bytes_lidos, n);
+    if (!tem_cr) tem_cr = memchr(nova.mem + bytes_lidos, '\r', n) != NULL;
+    bytes_lidos += n;
+  }
   // bytes_lidos pode ser diferente de tam_arq. em windows, a representação
   //   de um final de linha tem tamanho diferente no arquivo e em memória.
-  assert(bytes_lidos >= 0);
+  if (ferror(arq)) {
+    int erro = errno;
+    fclose(arq);
+    s_libera_mem(nova);
+    errno = erro;
+    return STR_VAZIA;
+  }
   fclose(arq);
 
   // ajusta outros campos da string
-  nova.tamb = bytes_lidos;
+  s_muda_tamb(&nova, bytes_lidos);
   nova.mem[nova.tamb] = '\0';
-  nova.tamc = u8_conta_unichar_nos_bytes(nova.mem, nova.tamb);
+  bool valido = u8_verificador_termina(&ver);
 
+  // o caso comum, utf8 válido sem BOM, não precisa de conversão
+  s_formato_t formato;
+  formato.codificacao = u8_detecta_codificacao(nova.mem, nova.tamb);
+  if (formato.codificacao == u8_utf8 && !valido && !u8_parece_utf8(nova.mem, nova.tamb)) {
+    formato.codificacao = u8_cp1252;
+  }
+  if (formato.codificacao == u8_utf8 && valido) {
+    nova.tamc = ver.nchars;
+  } else {
+    if (!s_transcodifica_sm(&nova, formato.codificacao)) {
+      s_libera_mem(nova);
+      return STR_VAZIA;
+    }
+    nova.tamc = u8_conta_unichar_sem_verificar(nova.mem, nova.tamb);
+  }
+  // finais de linha windows viram '\n'; cada '\r' removido é um caractere
+  formato.crlf = tem_cr && s_tem_crlf_sm(nova);
+  if (formato.crlf) {
+    int tamb = u8_tira_cr(nova.mem, nova.tamb);
+    nova.tamc -= nova.tamb - tamb;
+    s_muda_tamb(&nova, tamb);
+    nova.mem[nova.tamb] = '\0';
+    s_realoca(&nova, nova.tamb);
+  }
+  if (s_pol.copia_exata) s_realoca_exata(&nova);
+
+  s_indice_invalida(&nova, 0);
+  if (pformato != NULL) *pformato = formato;
   return nova;
 }
 
+str s_mapeia_arquivo(str nome)
+{
+  return s_mapeia_arquivo_formato(nome, NULL);
+}
+
+str s_mapeia_arquivo_formato(str nome, s_formato_t *pformato)
+{
+  s_ok(nome);
+  if (pformato != NULL) *pformato = (s_formato_t){ u8_utf8, false };
+  char *nomec = s_strc(nome);
+  int fd = open(nomec, O_RDONLY);
+  free(nomec);
+  if (fd < 0) return STR_VAZIA;
+  // arquivos vazios ou que não são arquivos normais são lidos normalmente
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return s_le_arquivo_formato(nome, pformato);
+  }
+  // o tamanho de uma str é um int; um arquivo maior não cabe, nem mapeado
+  //   nem copiado
+  if (st.st_size >= INT_MAX) {
+    close(fd);
+    errno = EFBIG;
+    return STR_VAZIA;
+  }
+  int nbytes = st.st_size;
+  byte *mapa = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapa == MAP_FAILED) return s_le_arquivo_formato(nome, pformato);
+  madvise(mapa, nbytes, MADV_SEQUENTIAL);
+  // só utf8 válido sem finais de linha windows pode ser usado como está
+  //   (o BOM fica de fora da string); o resto é lido e convertido
+  s_formato_t formato = { .codificacao = u8_detecta_codificacao(mapa, nbytes),
+                          .crlf = false };
+  int nbytes_bom = formato.codificacao == u8_utf8_bom ? 3 : 0;
+  int nchars = -1;
+  if (formato.codificacao == u8_utf8 || formato.codificacao == u8_utf8_bom) {
+    nchars = u8_conta_unichar_nos_bytes(mapa + nbytes_bom, nbytes - nbytes_bom);
+  }
+  str cad = s_cria_buf(mapa + nbytes_bom, nbytes - nbytes_bom, nchars);
+  cad.origem = s_mem_mapeada;
+  if (nchars < 0 || s_tem_crlf_sm(cad)) {
+    munmap(mapa, nbytes);
+    return s_le_arquivo_formato(nome, pformato);
+  }
+  if (pformato != NULL) *pformato = formato;
+  return cad;
+}
+
+void s_desmapeia(str cad)
+{
+  s_ok(cad);
+  // foi lida normalmente
+  if (s_alteravel(&cad)) {
+    s_destroi(cad);
+    return;
+  }
+  // só strings criadas por s_mapeia_arquivo (e não substrings delas)
+  if (cad.origem != s_mem_mapeada) return;
+  // a string mapeada não é alterável, e vai do início do mapeamento (ou logo
+  //   após o BOM, que fica na mesma página) até o final do arquivo; o
+  //   mapeamento começa no início da página onde está o primeiro byte
+  uintptr_t pagina = sysconf(_SC_PAGESIZE);
+  byte *mapa = (byte *)((uintptr_t)cad.mem & ~(pagina - 1));
+  munmap(mapa, cad.mem + cad.tamb - mapa);
+}
+
 void s_grava_arquivo(str cad, str nome)
 {
   s_ok(cad);
@@ -480,6 +1358,37 @@ void s_grava_arquivo(str cad, str nome)
   fclose(arq);
 }
 
+void s_grava_arquivo_formato(str cad, str nome, s_formato_t formato)
+{
+  s_ok(cad);
+  if (formato.codificacao == u8_utf8 && !formato.crlf) {
+    s_grava_arquivo(cad, nome);
+    return;
+  }
+  s_ok(nome);
+  char *nomec = s_strc(nome);
+  FILE *arq = fopen(nomec, "w");
+  free(nomec);
+  if (arq == NULL) return;
+  // converte em partes, sem cortar caracteres, para que a memória extra não
+  //   dependa do tamanho da string
+  byte *buf = malloc(4 * TAM_PARTE_CONVERSAO + 3);
+  assert(buf != NULL);
+  // só a marca de ordem de bytes, se o formato tiver
+  int nbuf = u8_codifica_em(NULL, 0, formato.codificacao, formato.crlf, buf);
+  fwrite(buf, 1, nbuf, arq); // ignora erros
+  byte *ptr = cad.mem;
+  byte *fim = cad.mem + cad.tamb;
+  while (ptr < fim) {
+    int nbytes = s_tam_parte(ptr, fim - ptr, TAM_PARTE_CONVERSAO, u8_utf8);
+    nbuf = u8_codifica_parte_em(ptr, nbytes, formato.codificacao, formato.crlf, buf);
+    fwrite(buf, 1, nbuf, arq);
+    ptr += nbytes;
+  }
+  free(buf);
+  fclose(arq);
+}
+
 
 // outras operações {{{1
 
@@ -491,12 +1400,131 @@ bool s_igual(str cad, str cadb)
   return memcmp(cad.mem, cadb.mem, cad.tamb) == 0;
 }
 
+int s_compara(str cad, str cadb)
+{
+  s_ok(cad);
+  s_ok(cadb);
+  // em utf8, a ordem dos bytes é a mesma dos codepoints
+  int tamb = cad.tamb < cadb.tamb ? cad.tamb : cadb.tamb;
+  if (tamb > 0) {
+    int comp = memcmp(cad.mem, cadb.mem, tamb);
+    if (comp != 0) return comp < 0 ? -1 : 1;
+  }
+  // uma é prefixo da outra: a menor vem antes
+  if (cad.tamb == cadb.tamb) return 0;
+  return cad.tamb < cadb.tamb ? -1 : 1;
+}
+
+// constantes e passos do hash (o algoritmo é o XXH64)
+#define HASH_P1 0x9E3779B185EBCA87ull
+#define HASH_P2 0xC2B2AE3D27D4EB4Full
+#define HASH_P3 0x165667B19E3779F9ull
+#define HASH_P4 0x85EBCA77C2B2AE63ull
+#define HASH_P5 0x27D4EB2F165667C5ull
+
+static inline uint64_t s_hash_rot(uint64_t x, int n)
+{
+  return (x << n) | (x >> (64 - n));
+}
+
+static inline uint64_t s_hash_le64(byte *p)
+{
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline uint32_t s_hash_le32(byte *p)
+{
+  uint32_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+// acrescenta a palavra w ao acumulador h
+static inline uint64_t s_hash_rodada(uint64_t h, uint64_t w)
+{
+  h += w * HASH_P2;
+  return s_hash_rot(h, 31) * HASH_P1;
+}
+
+// junta o acumulador v ao hash h
+static inline uint64_t s_hash_junta(uint64_t h, uint64_t v)
+{
+  h ^= s_hash_rodada(0, v);
+  return h * HASH_P1 + HASH_P4;
+}
+
+uint64_t s_hash(str cad, uint64_t semente)
+{
+  s_ok(cad);
+  byte *p = cad.mem;
+  byte *fim = cad.mem + cad.tamb;
+  uint64_t h;
+  if (cad.tamb >= 32) {
+    // 4 acumuladores independentes, cada um consumindo uma palavra de 8
+    //   bytes por volta, para que as multiplicações se sobreponham
+    uint64_t v1 = semente + HASH_P1 + HASH_P2;
+    uint64_t v2 = semente + HASH_P2;
+    uint64_t v3 = semente;
+    uint64_t v4 = semente - HASH_P1;
+    do {
+      v1 = s_hash_rodada(v1, s_hash_le64(p));
+      v2 = s_hash_rodada(v2, s_hash_le64(p + 8));
+      v3 = s_hash_rodada(v3, s_hash_le64(p + 16));
+      v4 = s_hash_rodada(v4, s_hash_le64(p + 24));
+      p += 32;
+    } while (fim - p >= 32);
+    h = s_hash_rot(v1, 1) + s_hash_rot(v2, 7) + s_hash_rot(v3, 12) + s_hash_rot(v4, 18);
+    h = s_hash_junta(h, v1);
+    h = s_hash_junta(h, v2);
+    h = s_hash_junta(h, v3);
+    h = s_hash_junta(h, v4);
+  } else {
+    h = semente + HASH_P5;
+  }
+  h += (uint64_t)cad.tamb;
+  // o que sobrou, de 8, 4 e 1 byte de cada vez
+  for (; fim - p >= 8; p += 8) {
+    h ^= s_hash_rodada(0, s_hash_le64(p));
+    h = s_hash_rot(h, 27) * HASH_P1 + HASH_P4;
+  }
+  if (fim - p >= 4) {
+    h ^= s_hash_le32(p) * HASH_P1;
+    h = s_hash_rot(h, 23) * HASH_P2 + HASH_P3;
+    p += 4;
+  }
+  for (; p < fim; p++) {
+    h ^= *p * HASH_P5;
+    h = s_hash_rot(h, 11) * HASH_P1;
+  }
+  // espalha os bits
+  h ^= h >> 33;
+  h *= HASH_P2;
+  h ^= h >> 29;
+  h *= HASH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
 void s_imprime(str cad)
 {
   s_ok(cad);
   fwrite(cad.mem, 1, cad.tamb, stdout);
 }
 
+int s_largura(str cad)
+{
+  s_ok(cad);
+  return u8_largura_bloco(cad.mem, cad.tamb);
+}
+
+int s_tam_na_largura(str cad, int larg)
+{
+  s_ok(cad);
+  return u8_unichar_na_largura(cad.mem, cad.tamb, larg);
+}
+
 char *s_strc(str cad)
 {
   char *strc = malloc(cad.tamb + 1);
@@ -508,17 +1536,278 @@ char *s_strc(str cad)
 
 Lstr s_separa(str cad, str separadores)
 {
-  Lstr lista = ls_cria();
-  int ini = 0, fim;
-  while (ini < s_tam(cad)) {
-    // busca a posição do primeiro separador após ini
-    fim = s_busca_c(cad, ini, separadores);
-    if (fim == -1) fim = s_tam(cad);
-    ls_insere_depois(lista, s_sub(cad, ini, fim - ini));
+  return s_separa_na_arena(cad, separadores, NULL);
+}
+
+// separa cad, copiando os pedaços para a lista ou, se copia for false,
+//   colocando nela substrings de cad
+static Lstr s_separa_sm(str cad, str separadores, s_arena *arena, bool copia)
+{
+  s_ok(cad);
+  s_ok(separadores);
+  Lstr lista = ls_cria_na_arena(arena);
+  // percorre cad uma só vez, por endereço, contando os caracteres de cada
+  //   pedaço só nos bytes dele (buscar e recortar cada pedaço por posição
+  //   percorreria cad desde o início a cada pedaço)
+  // um separador ASCII é buscado com memchr; os outros casos com o conjunto
+  bool um_byte = separadores.tamb == 1;
+  u8_conjunto_t conj;
+  if (!um_byte) u8_conjunto_inicia(&conj, separadores.mem, separadores.tamb);
+  byte *ptr = cad.mem;
+  byte *fim = cad.mem + cad.tamb;
+  while (ptr < fim) {
+    byte *sep;
+    if (um_byte) sep = memchr(ptr, separadores.mem[0], fim - ptr);
+    else sep = u8_busca_conjunto(ptr, fim - ptr, &conj, true);
+    if (sep == NULL) sep = fim;
+    int tamb = sep - ptr;
+    int tamc = 0;
+    if (tamb > 0) tamc = s_ascii(cad) ? tamb : u8_conta_unichar_sem_verificar(ptr, tamb);
+    str pedaco = { .tamc = tamc, .tamb = tamb, .cap = 0,
+                   .origem = s_mem_alocada, .mem = ptr, .ind = NULL };
+    if (copia) ls_insere_depois(lista, pedaco);
+    else ls_insere_depois_sem_copia(lista, pedaco);
     // pula o separador
-    ini = fim + 1;
+    if (sep == fim) break;
+    ptr = sep + u8_bytes_no_unichar_que_comeca_com(*sep);
   }
+  if (!um_byte) u8_conjunto_libera(&conj);
   return lista;
 }
 
+Lstr s_separa_na_arena(str cad, str separadores, s_arena *arena)
+{
+  return s_separa_sm(cad, separadores, arena, true);
+}
+
+Lstr s_separa_sem_copia(str cad, str separadores, s_arena *arena)
+{
+  return s_separa_sm(cad, separadores, arena, false);
+}
+
+// gravação de uma lista em um arquivo
+// os trechos (linhas e separadores) são acumulados em iov, e gravados de
+//   TAM_LOTE_IOV em TAM_LOTE_IOV com writev, direto da memória das strings;
+//   quando o formato pede conversão, os trechos são convertidos para buf,
+//   que é gravado quando enche
+typedef struct {
+  int fd;
+  s_formato_t formato;
+  struct iovec iov[TAM_LOTE_IOV];
+  int niov;
+  byte *buf;  // NULL se não tiver conversão
+  int nbuf;
+} s_gravacao_t;
+
+// grava os n trechos em iov no arquivo fd, continuando as gravações parciais
+static bool s_grava_iov(int fd, struct iovec *iov, int n)
+{
+  while (n > 0) {
+    ssize_t gravados = writev(fd, iov, n);
+    if (gravados < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    // pula os trechos que foram gravados inteiros, e o que foi gravado do
+    //   primeiro que não foi
+    while (n > 0 && (size_t)gravados >= iov->iov_len) {
+      gravados -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (byte *)iov->iov_base + gravados;
+      iov->iov_len -= gravados;
+    }
+  }
+  return true;
+}
+
+// grava o que está acumulado em g
+static bool s_grava_pendentes(s_gravacao_t *g)
+{
+  if (g->buf != NULL) {
+    g->iov[0] = (struct iovec){ g->buf, g->nbuf };
+    g->niov = 1;
+    g->nbuf = 0;
+  }
+  bool ok = s_grava_iov(g->fd, g->iov, g->niov);
+  g->niov = 0;
+  return ok;
+}
+
+// acrescenta cad ao que vai ser gravado por g
+static bool s_grava_trecho(s_gravacao_t *g, str cad)
+{
+  if (g->buf == NULL) {
+    if (cad.tamb == 0) return true;
+    g->iov[g->niov++] = (struct iovec){ cad.mem, cad.tamb };
+    if (g->niov == TAM_LOTE_IOV) return s_grava_pendentes(g);
+    return true;
+  }
+  // converte em partes, sem cortar caracteres, para que caibam em buf
+  byte *ptr = cad.mem;
+  byte *fim = cad.mem + cad.tamb;
+  while (ptr < fim) {
+    int nbytes = s_tam_parte(ptr, fim - ptr, TAM_PARTE_CONVERSAO, u8_utf8);
+    if (g->nbuf + 4 * nbytes > 4 * TAM_PARTE_CONVERSAO + 3) {
+      if (!s_grava_pendentes(g)) return false;
+    }
+    g->nbuf += u8_codifica_parte_em(ptr, nbytes, g->formato.codificacao,
+                                    g->formato.crlf, g->buf + g->nbuf);
+    ptr += nbytes;
+  }
+  return true;
+}
+
+// grava em fd as strings de lista, separadas por separador, no formato dado
+static bool s_grava_lista_fd(int fd, Lstr lista, str separador, s_formato_t formato)
+{
+  s_gravacao_t g = { .fd = fd, .formato = formato, .niov = 0, .buf = NULL, .nbuf = 0 };
+  if (formato.crlf || (formato.codificacao != u8_utf8 && formato.codificacao != u8_utf8_bom)) {
+    g.buf = malloc(4 * TAM_PARTE_CONVERSAO + 3);
+    assert(g.buf != NULL);
+    // só a marca de ordem de bytes, se o formato tiver
+    g.nbuf = u8_codifica_em(NULL, 0, formato.codificacao, formato.crlf, g.buf);
+  } else if (formato.codificacao == u8_utf8_bom) {
+    g.iov[g.niov++] = (struct iovec){ "\xEF\xBB\xBF", 3 };
+  }
+  bool ok = true;
+  bool primeira = true;
+  for (ls_inicio(lista); ok && ls_avanca(lista); ) {
+    if (!primeira) ok = s_grava_trecho(&g, separador);
+    primeira = false;
+    ok = ok && s_grava_trecho(&g, ls_item(lista));
+  }
+  ok = ok && s_grava_pendentes(&g);
+  free(g.buf);
+  return ok;
+}
+
+// retorna, em memória alocada, o nome do arquivo referenciado por nome,
+//   seguindo os links simbólicos no final do caminho (mesmo que o último
+//   aponte para um arquivo que ainda não existe), para que a gravação
+//   substitua o arquivo, e não o link
+// retorna NULL (com errno) se não conseguir chegar a um nome que não seja de
+//   link: ELOOP se os links formarem um ciclo (ou forem mais que MAX_LINKS)
+static char *s_resolve_links(char *nome)
+{
+  char *atual = strdup(nome);
+  assert(atual != NULL);
+  for (int i = 0; ; i++) {
+    struct stat st;
+    if (lstat(atual, &st) != 0 || !S_ISLNK(st.st_mode)) return atual;
+    char alvo[PATH_MAX];
+    ssize_t n = -1;
+    if (i == MAX_LINKS) {
+      errno = ELOOP;
+    } else {
+      n = readlink(atual, alvo, sizeof(alvo));
+      if (n == (ssize_t)sizeof(alvo)) {
+        errno = ENAMETOOLONG;
+        n = -1;
+      }
+    }
+    if (n < 0) {
+      free(atual);
+      return NULL;
+    }
+    alvo[n] = '\0';
+    // um alvo relativo é relativo ao diretório do link
+    char *barra = strrchr(atual, '/');
+    char *novo;
+    if (alvo[0] == '/' || barra == NULL) {
+      novo = strdup(alvo);
+    } else {
+      int tam_dir = barra - atual + 1;
+      novo = malloc(tam_dir + n + 1);
+      assert(novo != NULL);
+      memcpy(novo, atual, tam_dir);
+      strcpy(novo + tam_dir, alvo);
+    }
+    assert(novo != NULL);
+    free(atual);
+    atual = novo;
+  }
+}
+
+// dá ao arquivo aberto em fd o dono, o grupo e as permissões do arquivo
+//   chamado nome, se ele existir, ou as permissões que um arquivo novo teria
+// retorna false (com errno) se não conseguir
+static bool s_copia_permissoes(int fd, char *nome)
+{
+  struct stat st;
+  if (stat(nome, &st) != 0) {
+    mode_t mascara = umask(0);
+    umask(mascara);
+    return fchmod(fd, 0666 & ~mascara) == 0;
+  }
+  // só o superusuário pode mudar o dono (EPERM para os outros); nesse caso
+  //   tenta só o grupo, e se também não puder ficam os de quem grava
+  // fchown pode limpar os bits suid e sgid, por isso vem antes de fchmod
+  if (fchown(fd, st.st_uid, st.st_gid) != 0) {
+    if (errno != EPERM) return false;
+    if (fchown(fd, -1, st.st_gid) != 0 && errno != EPERM) return false;
+  }
+  return fchmod(fd, st.st_mode & 07777) == 0;
+}
+
+// garante que a entrada do arquivo chamado nome no seu diretório está no
+//   disco (depois de um rename, por exemplo)
+static void s_sincroniza_diretorio(char *nome)
+{
+  char *barra = strrchr(nome, '/');
+  char *dir = barra == NULL ? strdup(".") : strndup(nome, barra - nome + 1);
+  assert(dir != NULL);
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  free(dir);
+  if (fd < 0) return;
+  fsync(fd);
+  close(fd);
+}
+
+bool s_grava_arquivo_lista(Lstr lista, str separador, str nome)
+{
+  return s_grava_arquivo_lista_formato(lista, separador, nome,
+                                       (s_formato_t){ u8_utf8, false });
+}
+
+bool s_grava_arquivo_lista_formato(Lstr lista, str separador, str nome,
+                                   s_formato_t formato)
+{
+  s_ok(separador);
+  s_ok(nome);
+  // grava em um arquivo temporário no mesmo diretório, que só substitui o
+  //   arquivo com o nome pedido depois de estar inteiro no disco
+  // se o nome for de um link, o arquivo substituído é aquele para onde o
+  //   link aponta
+  char *nome_link = s_strc(nome);
+  assert(nome_link != NULL);
+  char *nomec = s_resolve_links(nome_link);
+  free(nome_link);
+  if (nomec == NULL) return false;
+  char *nome_tmp = malloc(strlen(nomec) + 8);
+  assert(nome_tmp != NULL);
+  sprintf(nome_tmp, "%s.XXXXXX", nomec);
+  bool ok = false;
+  int fd = mkstemp(nome_tmp);
+  if (fd >= 0) {
+    ok = s_copia_permissoes(fd, nomec)
+         && s_grava_lista_fd(fd, lista, separador, formato) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(nome_tmp, nomec) == 0;
+    if (ok) {
+      s_sincroniza_diretorio(nomec);
+    } else {
+      // não deixa o temporário para trás, mas mantém o erro
+      int erro = errno;
+      unlink(nome_tmp);
+      errno = erro;
+    }
+  }
+  free(nome_tmp);
+  free(nomec);
+  return ok;
+}
+
 // vim: foldmethod=marker shiftwidth=2
@@ -2,6 +2,7 @@
 #define _STR_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Cadeia de caracteres (str)
 //
@@ -23,13 +24,24 @@
 // str é o tipo de dados para nossas strings
 typedef struct str str;
 
+// de onde vem a memória de uma string alterável (ver abaixo)
+typedef enum {
+  s_mem_alocada,    // alocada pela string, segue a regra de alocação
+  s_mem_exata,      // alocada pela string, com o tamanho exato do conteúdo
+  s_mem_emprestada, // fornecida por quem criou a string
+  s_mem_mapeada,    // arquivo mapeado por s_mapeia_arquivo (string não
+                    //   alterável, liberada com s_desmapeia)
+} s_origem_t;
+
 // A estrutura é considerada aberta, mas só deve ser acessada diretamente
 //   por quem conhece e aceita as consequências.
 struct str {
   unsigned int tamc; // número de caracteres na string
   unsigned int tamb; // número de bytes na string
   unsigned int cap;  // número de bytes em mem, ou 0 se a string não é alterável
+  s_origem_t origem; // de onde vem a memória da string
   byte *mem;         // ponteiro para o primeiro byte do primeiro caractere
+  struct s_indice *ind; // índice de posições de caracteres, ou NULL
 };
 
 // As strings são em geral passadas para e retornadas de funções acessadas por
@@ -50,14 +62,33 @@ struct str {
 //     compatibilidade com strings C. Com isso, a maior string possível tem
 //     tamanho (em bytes) um a menos que o tamanho do região de memória
 //     (como strings C normais)
+//   a memória pode ser emprestada (origem é s_mem_emprestada): foi fornecida
+//     por quem criou a string (com s_copia_buf), e continua pertencendo a ele.
+//     A string usa essa memória enquanto couber, e passa para memória
+//     alocada por ela quando precisar de mais. A memória emprestada não é
+//     liberada na destruição, e seu tamanho não segue a regra de alocação.
+//   a memória pode ter o tamanho exato do conteúdo (origem é s_mem_exata),
+//     em cópias feitas quando a política de alocação pede (ver abaixo). A
+//     string passa a seguir a regra de alocação na primeira alteração que
+//     precise de mais memória (ou que deixe sobrando demais).
 // - não alterável:
 //   o campo cap é 0
 //   a memória não pertence à string, e não deve ser alterada nem liberada
 //   a memória pode pertencer a outra string, ou ser uma constante C ou qualquer
 //     memória passada para a função de criação (cujo tamanho é desconhecido)
+//   o campo origem é s_mem_alocada, exceto nas strings retornadas por
+//     s_mapeia_arquivo (s_mem_mapeada), que são liberadas por s_desmapeia
 //   uma string não alterável não deve ser passada por referência para funções
 //     que implementam operações que alteram a string
 //
+// Uma string alterável longa tem um índice (campo ind), com a posição em
+//   bytes de um caractere a cada tantos, para que o acesso a um caractere
+//   pela posição não precise percorrer a string desde o início. O índice é
+//   mantido pelas funções de str.c: é invalidado a partir da posição alterada
+//   e refeito só quando for necessário. Cópias da estrutura compartilham o
+//   índice, e estão sujeitas às mesmas regras de uso das substrings. Strings
+//   não alteráveis não têm índice (ind é NULL).
+//
 // Nas funções abaixo, o argumento `pos` refere-se à posição de um
 //   caractere (e não de um byte) em uma string. Esse argumento deve ser
 //   interpretado da seguinte forma:
@@ -98,6 +129,14 @@ int u8_nchars_na_strC(char *strc);
     .mem = (byte *)s               \
   }
 
+// cria e retorna uma cópia alterável de cad na memória em buf, que tem cap
+//   bytes (pelo menos cad.tamb + 1)
+// a memória em buf é emprestada à string: não é liberada por s_destroi, e
+//   deve continuar disponível enquanto a string existir
+// serve para guardar strings curtas junto de outros dados, sem uma
+//   alocação só para elas
+str s_copia_buf(str cad, byte *buf, int cap);
+
 // destrói a cadeia cad.
 // essa cadeia não deve ser utilizada após essa chamada
 // essa função deve liberar a memória em cadeias alteráveis
@@ -106,6 +145,33 @@ int u8_nchars_na_strC(char *strc);
 void s_destroi(str cad);
 
 
+// arenas {{{1
+
+// uma arena é uma região de memória de onde podem ser alocadas muitas
+//   strings (ou outros dados) de uma vez, cada uma com o custo de um
+//   incremento de ponteiro; nada é liberado individualmente, tudo é
+//   liberado na destruição da arena, de bloco em bloco
+// as strings copiadas para uma arena têm memória emprestada (ver acima):
+//   enquanto não precisarem crescer, ficam na arena; se crescerem, passam
+//   para memória alocada por elas, que deve ser liberada com s_destroi
+typedef struct s_arena s_arena;
+
+// cria e retorna uma arena vazia, que deve ser destruída com s_arena_destroi
+s_arena *s_arena_cria(void);
+
+// destrói a arena, liberando toda a memória alocada dela
+// as strings copiadas para a arena não devem ser usadas após essa chamada
+//   (exceto para serem destruídas, se tiverem deixado a arena)
+void s_arena_destroi(s_arena *arena);
+
+// retorna um ponteiro para nbytes de memória da arena, alinhados para
+//   qualquer tipo de dado
+void *s_arena_aloca(s_arena *arena, int nbytes);
+
+// cria e retorna uma cópia alterável de cad, com memória emprestada da arena
+str s_copia_em(s_arena *arena, str cad);
+
+
 // operações de acesso {{{1
 
 // retorna o tamanho (número de caracteres) de cad
@@ -168,6 +234,18 @@ int s_busca_rc(str cad, int pos, str chs);
 // retorna -1 se não encontrar
 int s_busca_rnc(str cad, int pos, str chs);
 
+// retorna a posição logo após a sequência de caracteres da mesma classe
+//   (espaço, palavra, pontuação, ideograma -- ver u8_classe) que inicia
+//   na posição pos de cad
+// se grande for true, só se distingue espaço de não espaço
+// se pos for o final de cad, retorna pos
+int s_fim_classe(str cad, int pos, bool grande);
+
+// retorna a posição do início da sequência de caracteres da mesma classe
+//   que termina logo antes da posição pos de cad
+// se pos for 0, retorna 0
+int s_inicio_classe(str cad, int pos, bool grande);
+
 // retorna a primeira posição em cad, não antes de pos, onde tem
 //   a substring buscada
 // retorna -1 se não encontrar
@@ -187,6 +265,45 @@ int s_busca_s(str cad, int pos, str buscada);
 //   a 8, e nem inferior a 1/3 do tamanho da string. o aumento/diminuição do 
 //   tamanho da memória deve ser feito sempre com a razão 2 (os tamanhos
 //   válidos são 8, 16, 32, 64 etc)
+// a política de alocação pode alterar essa regra: a redução da memória pode
+//   esperar até que a memória seja maior que um limite maior que 3 vezes o
+//   tamanho da string (para que uma sequência de remoções e inserções não
+//   realoque a cada operação), e as cópias podem ter memória exata
+
+// política de alocação da memória das strings alteráveis
+typedef struct {
+  // se true, s_copia e s_le_arquivo alocam só a memória necessária; a
+  //   string passa a seguir a regra na primeira alteração que precisar
+  bool copia_exata;
+  // a memória só é reduzida quando for maior que limite_encolhe vezes o
+  //   número de bytes da string; deve ser pelo menos 3
+  int limite_encolhe;
+} s_politica_t;
+
+// a política inicial, que segue a regra acima
+#define S_POLITICA_PADRAO ((s_politica_t){ .copia_exata = false, .limite_encolhe = 3 })
+
+// altera a política de alocação, para as alocações futuras
+void s_define_politica(s_politica_t politica);
+
+// retorna a política de alocação em uso
+s_politica_t s_politica(void);
+
+// contadores das alocações de memória de strings alteráveis (não contam a
+//   memória emprestada)
+typedef struct {
+  long alocacoes;          // blocos de memória alocados
+  long realocacoes;        // mudanças de tamanho de um bloco
+  long liberacoes;         // blocos liberados
+  long promocoes;          // strings com memória exata ou emprestada que
+                           //   passaram a seguir a regra de alocação
+  long long bytes_alocados; // memória alocada atualmente
+  long long bytes_usados;   // quanto dessa memória está ocupado (com o \0);
+                            //   a diferença é a memória desperdiçada
+} s_estatisticas_t;
+
+// retorna os contadores de alocação, desde o início do programa
+s_estatisticas_t s_estatisticas(void);
 
 // cria e retorna uma string alterável que contém uma cópia de cad
 // o tamanho da memória alocada deve seguir as regras das operações
@@ -234,16 +351,128 @@ void s_preenche(str *pcad, int tam, str enchimento);
 //   2,200,"" -> "ab"
 void s_subst(str *pcad, int pos, int tam, str cadb, str enchimento);
 
+// converte para maiúsculas os caracteres da substring de tamanho tam
+//   iniciando em pos em *pcad
+// não faz nada se a cadeia apontada por pcad não for alterável
+// pos e tam devem ser interpretados como em s_sub
+// a conversão é de um caractere para um (ver u8_maiuscula), mas pode mudar
+//   o número de bytes da cadeia
+void s_maiuscula(str *pcad, int pos, int tam);
+
+// como s_maiuscula, mas converte para minúsculas
+void s_minuscula(str *pcad, int pos, int tam);
+
+// como s_maiuscula, mas troca maiúsculas por minúsculas e vice-versa
+void s_alterna_caixa(str *pcad, int pos, int tam);
+
+// normaliza a cadeia apontada por pcad para a forma NFC (caracteres
+//   pré-compostos), para que cadeias que representam o mesmo texto possam
+//   ser comparadas com s_igual e s_busca_s
+// não faz nada se a cadeia apontada por pcad não for alterável
+// a verificação rápida confirma sem alterar a cadeia que a maior parte
+//   dos textos já está normalizada
+void s_normaliza(str *pcad);
+
+
+// strings com lacuna {{{1
+
+// uma string com lacuna (gap buffer) guarda seu conteúdo com um buraco (a
+//   lacuna) na posição da última alteração; inserir ou remover nessa posição
+//   só muda os limites da lacuna, sem mover o restante da string, e mudar a
+//   lacuna de lugar só move os caracteres entre a posição antiga e a nova
+// serve para uma sequência de alterações próximas umas das outras, como as
+//   de quem digita em uma linha de texto; enquanto está com lacuna, a string
+//   só pode ser acessada pelas funções abaixo
+typedef struct s_lacuna s_lacuna;
+
+// cria e retorna uma string com lacuna com o conteúdo de cad
+// se cad for alterável, sua memória passa a ser usada pela string com lacuna,
+//   sem cópia, e cad não deve mais ser usada
+s_lacuna *s_lacuna_cria(str cad);
+
+// fecha a lacuna, e retorna a string alterável resultante
+// lac não deve mais ser usada após essa chamada
+str s_lacuna_fecha(s_lacuna *lac);
+
+// retorna o tamanho (número de caracteres) do conteúdo de lac
+int s_lacuna_tam(s_lacuna *lac);
+
+// retorna uma cadeia não alterável com tam caracteres de lac a partir de
+//   pos (ajustados aos limites como em s_sub)
+// se a lacuna estiver no meio do trecho, ela é levada para o extremo mais
+//   próximo do trecho
+// a cadeia retornada não pode ser usada após outra operação em lac
+str s_lacuna_sub(s_lacuna *lac, int pos, int tam);
+
+// insere cadb antes do caractere na posição pos de lac
+// a lacuna passa para depois do que foi inserido
+void s_lacuna_insere(s_lacuna *lac, int pos, str cadb);
+
+// remove tam caracteres de lac a partir de pos
+// a lacuna passa para o lugar do que foi removido
+void s_lacuna_remove(s_lacuna *lac, int pos, int tam);
+
 
 // operações de acesso a arquivo {{{1
 
+// formato de um arquivo de texto: a codificação dos caracteres e se os
+//   finais de linha são "\r\n"
+typedef struct {
+  u8_codificacao_t codificacao;
+  bool crlf;
+} s_formato_t;
+
 // cria uma cadeia alterável com o conteúdo do arquivo chamado nome
-// retorna uma cadeia vazia (não alterável) em caso de erro
+// o arquivo pode estar em utf8, utf16 ou cp1252 (ver u8_detecta_codificacao)
+//   e é convertido para utf8, sem BOM e com finais de linha "\n"; bytes
+//   inválidos são substituídos por 0xFFFD
+// retorna uma cadeia vazia (não alterável) em caso de erro, com s_mem NULL e
+//   errno indicando o erro (um arquivo vazio resulta em uma cadeia alterável)
+// uma cadeia alterável tem menos de 1GiB (ver s_realoca); se o arquivo, ou o
+//   resultado da conversão, não couber, o erro é EFBIG
 str s_le_arquivo(str nome);
 
+// como s_le_arquivo, e coloca em *pformato (se não for NULL) o formato
+//   original do arquivo, para que possa ser gravado de volta nesse formato
+// em caso de erro, e para um arquivo vazio, o formato é utf8 sem "\r\n"
+str s_le_arquivo_formato(str nome, s_formato_t *pformato);
+
+// como s_le_arquivo, mas não copia o arquivo: retorna uma cadeia não
+//   alterável que referencia o arquivo mapeado em memória (mmap), cujas
+//   páginas são lidas pelo sistema quando acessadas
+// o conteúdo é percorrido uma vez, para verificar o utf8 e contar os
+//   caracteres, sem alocar memória para ele
+// se o arquivo precisar de conversão (não for utf8 ou tiver finais de linha
+//   windows), ou não puder ser mapeado, é lido com s_le_arquivo, e a cadeia
+//   retornada é alterável
+// a cadeia retornada deve ser liberada com s_desmapeia (e não com
+//   s_destroi), e não pode ser usada depois disso; substrings dela não são
+//   mapeadas, e não devem ser usadas após a liberação
+// o mapeamento continua válido se o arquivo for regravado com
+//   s_grava_arquivo_lista (que substitui o arquivo por outro), mas não se
+//   outro programa truncar o arquivo: o acesso a páginas que deixaram de
+//   existir termina o programa (SIGBUS)
+// o tamanho de uma str é um int: um arquivo com INT_MAX bytes ou mais não é
+//   mapeado nem lido; é retornada uma cadeia vazia, com errno EFBIG
+// os erros são indicados como em s_le_arquivo
+str s_mapeia_arquivo(str nome);
+
+// como s_mapeia_arquivo, e coloca em *pformato (se não for NULL) o formato
+//   original do arquivo
+str s_mapeia_arquivo_formato(str nome, s_formato_t *pformato);
+
+// libera uma cadeia retornada por s_mapeia_arquivo
+// se cad for alterável (o arquivo foi lido e não mapeado), é destruída; outras
+//   cadeias não mapeadas (constantes, substrings) são ignoradas
+void s_desmapeia(str cad);
+
 // grava o conteúdo de cad em um arquivo chamado nome
 void s_grava_arquivo(str cad, str nome);
 
+// grava o conteúdo de cad em um arquivo chamado nome, convertendo para o
+//   formato dado
+void s_grava_arquivo_formato(str cad, str nome, s_formato_t formato);
+
 
 // outras operações {{{1
 
@@ -251,9 +480,28 @@ void s_grava_arquivo(str cad, str nome);
 // se não forem do mesmo tamanho, são diferentes
 bool s_igual(str cad, str cadb);
 
+// compara cad com cadb, na ordem dos codepoints dos caracteres (que em
+//   utf8 é a ordem dos bytes); se uma for prefixo da outra, a menor vem antes
+// retorna -1 se cad vem antes de cadb, 0 se forem iguais, 1 se vem depois
+int s_compara(str cad, str cadb);
+
+// retorna um hash de 64 bits do conteúdo de cad, que depende da semente
+// strings iguais (ver s_igual) têm o mesmo hash, com a mesma semente
+// o algoritmo é o XXH64, que consome 32 bytes por volta; o valor depende da
+//   ordem dos bytes da máquina
+uint64_t s_hash(str cad, uint64_t semente);
+
 // imprime a cadeia em cad na saída padrão
 void s_imprime(str cad);
 
+// retorna o número de colunas que a cadeia em cad ocupa em um terminal
+//   (caracteres largos ocupam 2 colunas, marcas de combinação nenhuma)
+int s_largura(str cad);
+
+// retorna quantos caracteres do início de cad cabem em larg colunas de
+//   um terminal
+int s_tam_na_largura(str cad, int larg);
+
 // retorna uma cópia compatível com string C da string em cad, em uma nova
 //   memória alocada com malloc de um byte a mais que o número de bytes da
 //   string.
@@ -267,8 +515,44 @@ char *s_strc(str cad);
 //   substrings estiverem sendo usadas.
 // separa "abacaxi,banana;maçã", ",;" -> ["abacaxi", "banana", "maçã"]
 // separa "abacaxi,banana;maçã", "," -> ["abacaxi", "banana;maçã"]
+// se separadores for vazia, a lista tem um só item, com toda cad
+// cad é percorrida uma só vez (com memchr, se o separador for um caractere
+//   ASCII), com custo linear no seu tamanho
 Lstr s_separa(str cad, str separadores);
 
+// como s_separa, mas a lista retornada guarda seus itens na arena (ver
+//   ls_cria_na_arena)
+Lstr s_separa_na_arena(str cad, str separadores, s_arena *arena);
+
+// como s_separa_na_arena, mas os pedaços não são copiados: os itens da lista
+//   são substrings não alteráveis de cad (ver ls_insere_depois_sem_copia), e
+//   só os nós da lista ocupam a arena (arena pode ser NULL)
+// cad deve continuar existindo, sem ser alterada, enquanto a lista existir
+Lstr s_separa_sem_copia(str cad, str separadores, s_arena *arena);
+
+// grava as strings de lista em um arquivo chamado nome, com separador entre
+//   elas (s_("\n"), por exemplo), sem juntá-las em uma só string: os bytes
+//   são gravados (com writev) direto da memória de cada string
+// o conteúdo é gravado em um arquivo temporário no mesmo diretório, que só
+//   substitui o arquivo chamado nome (com rename) depois de estar no disco
+//   (fsync); o arquivo novo fica com o dono, o grupo (se quem grava puder
+//   dá-los) e as permissões do que foi substituído
+// se nome for um link simbólico, é substituído o arquivo para onde ele
+//   aponta, e o link continua sendo um link
+// o arquivo novo é outro arquivo (outro inode): se o substituído tinha
+//   outros nomes (links físicos, st_nlink > 1), esses nomes continuam com o
+//   conteúdo antigo
+// retorna false em caso de erro (errno diz qual), e nesse caso o arquivo
+//   chamado nome não é alterado
+// a posição corrente da lista é alterada
+bool s_grava_arquivo_lista(Lstr lista, str separador, str nome);
+
+// como s_grava_arquivo_lista, convertendo para o formato dado
+// nos formatos que precisam de conversão, o conteúdo é convertido em partes,
+//   sem que seja necessário memória para o arquivo inteiro
+bool s_grava_arquivo_lista_formato(Lstr lista, str separador, str nome,
+                                   s_formato_t formato);
+
 #endif // _STR_H_
 // vim: foldmethod=marker shiftwidth=2
 
@@ -1,7 +1,16 @@
 #include "utf8.h"
+#include "utf8_tabelas.h"
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define U8_SIMD_X86
+#include <immintrin.h>
+#endif
 
 // funções auxiliares para codificação UTF8 {{{1
 
@@ -43,16 +52,6 @@ static bool u8_byte_de_continuacao(byte b)
   return (b & 0b11000000) == 0b10000000;
 }
 
-// adiciona os 6 bits do byte do continuação cont em *uni
-// retorna false se cont não for válido
-static bool u8_soma_bits_de_continuacao(unichar *uni, byte cont)
-{
-  if (!u8_byte_de_continuacao(cont)) return false;
-  byte bits = cont & 0b00111111;
-  *uni = ((*uni) << 6) | bits;
-  return true;
-}
-
 bool u8_unichar_valido(unichar uni)
 {
   if (uni > 0x10FFFF) return false;
@@ -60,45 +59,1016 @@ bool u8_unichar_valido(unichar uni)
   return true;
 }
 
+// decodificação por autômato {{{1
+
+// A decodificação é feita por um autômato finito determinístico, em que cada
+//   byte causa uma transição de estado (Hoehrmann, "Flexible and Economical
+//   UTF-8 Decoder"). O estado diz quantos bytes de continuação ainda faltam
+//   e, logo após alguns bytes iniciais, qual a faixa permitida para o
+//   próximo byte (é assim que se detecta codificações longas demais, códigos
+//   acima de 0x10FFFF e surrogates). Não tem desvios condicionais por byte.
+//
+// Para a tabela ficar pequena, os bytes são agrupados em 12 classes, que
+//   têm o mesmo comportamento em todos os estados.
+// Os estados são representados por múltiplos de 6, e as transições causadas
+//   por uma classe estão todas em um único inteiro de 64 bits: o próximo
+//   estado quando o estado atual é e está nos 6 bits a partir do bit e
+//   ("shift DFA").
+
+// estados do autômato
+#define U8D_ACEITA 0  // entre caracteres (o último terminou bem)
+#define U8D_ERRO   6  // encontrou erro; não sai mais desse estado
+#define U8D_FALTA1 12 // falta 1 byte de continuação
+#define U8D_FALTA2 18 // faltam 2 bytes de continuação
+#define U8D_FALTA3 24 // faltam 3 bytes de continuação
+#define U8D_E0     30 // depois de E0: A0-BF, depois 1 continuação
+#define U8D_ED     36 // depois de ED: 80-9F (não pode ser surrogate), depois 1
+#define U8D_F0     42 // depois de F0: 90-BF, depois 2
+#define U8D_F4     48 // depois de F4: 80-8F (não pode passar de 10FFFF), depois 2
+
+// classe de cada byte
+//   0: 00-7F    1: 80-8F    2: C2-DF    3: E1-EC,EE-EF   4: ED   5: F4
+//   6: F1-F3    7: A0-BF    8: C0-C1,F5-FF (nunca aparecem)  9: 90-9F
+//   10: E0     11: F0
+// os números das classes são escolhidos para que (0xFF >> classe) seja a
+//   máscara dos bits de código em um byte inicial
+static const byte u8_classe_byte[256] = {
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1, 9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+  7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, 7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+  8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2, 2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
+  10,3,3,3,3,3,3,3,3,3,3,3,3,4,3,3, 11,6,6,6,5,8,8,8,8,8,8,8,8,8,8,8,
+};
+
+// monta as transições de uma classe, com o próximo estado para cada estado
+#define U8D_T(aceita, falta1, falta2, falta3, e0, ed, f0, f4)             \
+  ( ((uint64_t)(aceita) << U8D_ACEITA) | ((uint64_t)U8D_ERRO << U8D_ERRO) \
+  | ((uint64_t)(falta1) << U8D_FALTA1) | ((uint64_t)(falta2) << U8D_FALTA2) \
+  | ((uint64_t)(falta3) << U8D_FALTA3) | ((uint64_t)(e0) << U8D_E0)       \
+  | ((uint64_t)(ed) << U8D_ED) | ((uint64_t)(f0) << U8D_F0)               \
+  | ((uint64_t)(f4) << U8D_F4) )
+#define E U8D_ERRO
+static const uint64_t u8_transicao[12] = {
+  //         aceita      falta1      falta2      falta3      e0          ed          f0          f4
+  [0]  = U8D_T(U8D_ACEITA, E,          E,          E,          E,          E,          E,          E),
+  [1]  = U8D_T(E,          U8D_ACEITA, U8D_FALTA1, U8D_FALTA2, E,          U8D_FALTA1, E,          U8D_FALTA2),
+  [2]  = U8D_T(U8D_FALTA1, E,          E,          E,          E,          E,          E,          E),
+  [3]  = U8D_T(U8D_FALTA2, E,          E,          E,          E,          E,          E,          E),
+  [4]  = U8D_T(U8D_ED,     E,          E,          E,          E,          E,          E,          E),
+  [5]  = U8D_T(U8D_F4,     E,          E,          E,          E,          E,          E,          E),
+  [6]  = U8D_T(U8D_FALTA3, E,          E,          E,          E,          E,          E,          E),
+  [7]  = U8D_T(E,          U8D_ACEITA, U8D_FALTA1, U8D_FALTA2, U8D_FALTA1, E,          U8D_FALTA2, E),
+  [8]  = U8D_T(E,          E,          E,          E,          E,          E,          E,          E),
+  [9]  = U8D_T(E,          U8D_ACEITA, U8D_FALTA1, U8D_FALTA2, E,          U8D_FALTA1, U8D_FALTA2, E),
+  [10] = U8D_T(U8D_E0,     E,          E,          E,          E,          E,          E,          E),
+  [11] = U8D_T(U8D_F0,     E,          E,          E,          E,          E,          E,          E),
+};
+#undef E
+
+// faz a transição do estado *pestado causada pelo byte b, acumulando
+//   em *puni os bits de código que o byte contém
+static inline void u8_transita(unsigned *pestado, unichar *puni, byte b)
+{
+  int classe = u8_classe_byte[b];
+  if (*pestado == U8D_ACEITA) {
+    *puni = (0xFFu >> classe) & b;
+  } else {
+    *puni = (*puni << 6) | (b & 0x3Fu);
+  }
+  *pestado = (u8_transicao[classe] >> *pestado) & 63;
+}
+
 int u8_unichar_nos_bytes(byte *s, int maxn, unichar *puni)
 {
-  byte primeiro_byte = s[0];
-  int nbytes = u8_bytes_no_unichar_que_comeca_com(primeiro_byte);
-  if (nbytes < 1 || nbytes > maxn || nbytes > 4) return -1;
+  if (maxn < 1) return -1;
+  if (s[0] < 0x80) {
+    // ASCII, não precisa do autômato
+    if (puni != NULL) *puni = s[0];
+    return 1;
+  }
+  unsigned estado = U8D_ACEITA;
+  unichar uni = 0;
+  if (maxn > 4) maxn = 4;
+  for (int i = 0; i < maxn; i++) {
+    u8_transita(&estado, &uni, s[i]);
+    if (estado == U8D_ACEITA) {
+      if (puni != NULL) *puni = uni;
+      return i + 1;
+    }
+    if (estado == U8D_ERRO) return -1;
+  }
+  return -1;
+}
+
+// versão escalar da contagem com verificação
+// o autômato é executado sobre todos os bytes sem interrupção, contando
+//   quantas vezes passa pelo estado U8D_ACEITA (o estado de erro é
+//   permanente, basta testar no final)
+static int u8_conta_escalar(byte *ptr, int nbytes)
+{
+  int num_uni = 0;
+  unsigned estado = U8D_ACEITA;
+  for (int i = 0; i < nbytes; i++) {
+    estado = (u8_transicao[u8_classe_byte[ptr[i]]] >> estado) & 63;
+    num_uni += (estado == U8D_ACEITA);
+  }
+  if (estado != U8D_ACEITA) return -1;
+  return num_uni;
+}
+
+// validação e contagem vetorizadas {{{1
+
+// A validação vetorizada segue o algoritmo "lookup" de Keiser e Lemire
+//   ("Validating UTF-8 in less than one instruction per byte", 2021).
+// Cada byte é classificado de acordo com seus 4 bits mais significativos e
+//   com os 4 bits mais e menos significativos do byte anterior, usando 3
+//   consultas a tabelas de 16 entradas (instrução pshufb). Cada bit da
+//   classificação representa um tipo de erro possível em uma sequência de 2
+//   bytes; o "e" bit a bit das 3 classificações só é diferente de 0 onde
+//   tem erro.
+// Os erros que envolvem mais de 2 bytes (falta de bytes de continuação em
+//   sequências de 3 ou 4 bytes) são detectados verificando se os bytes 2 e
+//   3 posições depois de um byte inicial de 3 e 4 bytes são de continuação.
+// Um bloco só com bytes ASCII (o caso mais comum) só precisa verificar se
+//   o bloco anterior não terminou no meio de um caractere.
+// A contagem é o número de bytes que não são de continuação.
+// O final do buffer que não completa um bloco (e o último caractere dos
+//   blocos, que pode continuar depois deles) é tratado pela versão escalar.
+
+#ifdef U8_SIMD_X86
+
+// tipos de erro, cada um representado por um bit na classificação
+#define U8E_CURTO     (1 << 0) // 11______ 0_______ ou 11______ 11______
+#define U8E_LONGO     (1 << 1) // 0_______ 10______
+#define U8E_LONGO_3   (1 << 2) // 11100000 100_____
+#define U8E_GRANDE    (1 << 3) // 11110100 1001____ ou 11110100 101_____ ou 11110101+
+#define U8E_SURROGATE (1 << 4) // 11101101 101_____
+#define U8E_LONGO_2   (1 << 5) // 1100000_ 10______
+#define U8E_GRANDE_1000 (1 << 6) // 11110101+ 1000____
+#define U8E_LONGO_4   (1 << 6) // 11110000 1000____
+#define U8E_DUAS_CONT (1 << 7) // 10______ 10______
+#define U8E_PASSA     (U8E_CURTO | U8E_LONGO | U8E_DUAS_CONT)
 
-  // monta o código uni à partir dos bytes utf8
-  //   máscara binária com os bits válidos para o 1o byte de cada tamanho
-  byte mascara[] = { 0b01111111, 0b00011111, 0b00001111, 0b00000111, };
-  unichar uni = primeiro_byte & mascara[nbytes - 1];
-  int nbytes_adicionados = 1;
-  while (nbytes > nbytes_adicionados) {
-    if (!u8_soma_bits_de_continuacao(&uni, s[nbytes_adicionados])) return -1;
-    nbytes_adicionados++;
+// tabelas de classificação, indexadas pelos 4 bits de cada byte
+#define U8_TAB_B1_ALTO                                                     \
+  U8E_LONGO, U8E_LONGO, U8E_LONGO, U8E_LONGO,                              \
+  U8E_LONGO, U8E_LONGO, U8E_LONGO, U8E_LONGO,                              \
+  U8E_DUAS_CONT, U8E_DUAS_CONT, U8E_DUAS_CONT, U8E_DUAS_CONT,              \
+  U8E_CURTO | U8E_LONGO_2,                                                 \
+  U8E_CURTO,                                                               \
+  U8E_CURTO | U8E_LONGO_3 | U8E_SURROGATE,                                 \
+  U8E_CURTO | U8E_GRANDE | U8E_GRANDE_1000 | U8E_LONGO_4
+#define U8_TAB_B1_BAIXO                                                    \
+  U8E_PASSA | U8E_LONGO_3 | U8E_LONGO_2 | U8E_LONGO_4,                     \
+  U8E_PASSA | U8E_LONGO_2,                                                 \
+  U8E_PASSA,                                                               \
+  U8E_PASSA,                                                               \
+  U8E_PASSA | U8E_GRANDE,                                                  \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000 | U8E_SURROGATE,                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000,                                \
+  U8E_PASSA | U8E_GRANDE | U8E_GRANDE_1000
+#define U8_TAB_B2_ALTO                                                     \
+  U8E_CURTO, U8E_CURTO, U8E_CURTO, U8E_CURTO,                              \
+  U8E_CURTO, U8E_CURTO, U8E_CURTO, U8E_CURTO,                              \
+  U8E_LONGO | U8E_LONGO_2 | U8E_DUAS_CONT | U8E_LONGO_3 | U8E_GRANDE_1000  \
+    | U8E_LONGO_4,                                                         \
+  U8E_LONGO | U8E_LONGO_2 | U8E_DUAS_CONT | U8E_LONGO_3 | U8E_GRANDE,      \
+  U8E_LONGO | U8E_LONGO_2 | U8E_DUAS_CONT | U8E_SURROGATE | U8E_GRANDE,    \
+  U8E_LONGO | U8E_LONGO_2 | U8E_DUAS_CONT | U8E_SURROGATE | U8E_GRANDE,    \
+  U8E_CURTO, U8E_CURTO, U8E_CURTO, U8E_CURTO
+// valor máximo de cada um dos 3 últimos bytes de um bloco para que não
+//   seja o início de um caractere que continua no bloco seguinte
+#define U8_MAX_FIM 0xEF, 0xDF, 0xBF
+
+// termina a contagem de um buffer cujos primeiros p bytes foram verificados
+//   pela versão vetorizada, que contou neles num_uni caracteres
+// o último caractere que inicia nesses p bytes pode não terminar neles; a
+//   verificação é refeita a partir do início dele pela versão escalar
+static int u8_conta_final(byte *ptr, int nbytes, int p, int num_uni)
+{
+  int q = p;
+  while (q > 0 && p - q < 3 && u8_byte_de_continuacao(ptr[q - 1])) q--;
+  if (q > 0) {
+    // ptr[q-1] é o byte inicial do último caractere, já contado
+    q--;
+    num_uni--;
   }
+  int num_final = u8_conta_escalar(ptr + q, nbytes - q);
+  if (num_final == -1) return -1;
+  return num_uni + num_final;
+}
 
-  // verifica se o código é válido
-  if (nbytes > 1 && uni < 0x80) return -1;
-  if (nbytes > 2 && uni < 0x800) return -1;
-  if (nbytes > 3 && uni < 0x10000) return -1;
-  if (!u8_unichar_valido(uni)) return -1;
+__attribute__((target("sse4.2")))
+static int u8_conta_sse(byte *ptr, int nbytes)
+{
+  const __m128i tab_b1_alto = _mm_setr_epi8(U8_TAB_B1_ALTO);
+  const __m128i tab_b1_baixo = _mm_setr_epi8(U8_TAB_B1_BAIXO);
+  const __m128i tab_b2_alto = _mm_setr_epi8(U8_TAB_B2_ALTO);
+  const __m128i max_fim = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, U8_MAX_FIM);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i bit_alto = _mm_set1_epi8((char)0x80);
+  const __m128i lim_3 = _mm_set1_epi8(0xE0 - 0x80);
+  const __m128i lim_4 = _mm_set1_epi8(0xF0 - 0x80);
+  const __m128i lim_cont = _mm_set1_epi8(-64); // 0xC0 (bytes 0x80-0xBF são menores)
+  __m128i anterior = _mm_setzero_si128();
+  __m128i incompleto = _mm_setzero_si128();
+  __m128i erro = _mm_setzero_si128();
+  int num_cont = 0;
+  int p = 0;
+  for (; p + 16 <= nbytes; p += 16) {
+    __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+    if (_mm_movemask_epi8(bloco) == 0) {
+      erro = _mm_or_si128(erro, incompleto);
+      incompleto = _mm_setzero_si128();
+      anterior = bloco;
+      continue;
+    }
+    __m128i ant1 = _mm_alignr_epi8(bloco, anterior, 16 - 1);
+    __m128i ant2 = _mm_alignr_epi8(bloco, anterior, 16 - 2);
+    __m128i ant3 = _mm_alignr_epi8(bloco, anterior, 16 - 3);
+    __m128i b1_alto = _mm_shuffle_epi8(tab_b1_alto,
+                        _mm_and_si128(_mm_srli_epi16(ant1, 4), nibble));
+    __m128i b1_baixo = _mm_shuffle_epi8(tab_b1_baixo, _mm_and_si128(ant1, nibble));
+    __m128i b2_alto = _mm_shuffle_epi8(tab_b2_alto,
+                        _mm_and_si128(_mm_srli_epi16(bloco, 4), nibble));
+    __m128i classe = _mm_and_si128(_mm_and_si128(b1_alto, b1_baixo), b2_alto);
+    __m128i deve_cont = _mm_or_si128(_mm_subs_epu8(ant2, lim_3),
+                                     _mm_subs_epu8(ant3, lim_4));
+    deve_cont = _mm_and_si128(deve_cont, bit_alto);
+    erro = _mm_or_si128(erro, _mm_xor_si128(deve_cont, classe));
+    incompleto = _mm_subs_epu8(bloco, max_fim);
+    num_cont += __builtin_popcount(_mm_movemask_epi8(_mm_cmplt_epi8(bloco, lim_cont)));
+    anterior = bloco;
+  }
+  if (!_mm_testz_si128(erro, erro)) return -1;
+  return u8_conta_final(ptr, nbytes, p, p - num_cont);
+}
 
-  if (puni != NULL) *puni = uni;
-  return nbytes;
+__attribute__((target("avx2")))
+static int u8_conta_avx2(byte *ptr, int nbytes)
+{
+  const __m256i tab_b1_alto = _mm256_setr_epi8(U8_TAB_B1_ALTO, U8_TAB_B1_ALTO);
+  const __m256i tab_b1_baixo = _mm256_setr_epi8(U8_TAB_B1_BAIXO, U8_TAB_B1_BAIXO);
+  const __m256i tab_b2_alto = _mm256_setr_epi8(U8_TAB_B2_ALTO, U8_TAB_B2_ALTO);
+  const __m256i max_fim = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, U8_MAX_FIM);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i bit_alto = _mm256_set1_epi8((char)0x80);
+  const __m256i lim_3 = _mm256_set1_epi8(0xE0 - 0x80);
+  const __m256i lim_4 = _mm256_set1_epi8(0xF0 - 0x80);
+  const __m256i lim_cont = _mm256_set1_epi8(-64);
+  __m256i anterior = _mm256_setzero_si256();
+  __m256i incompleto = _mm256_setzero_si256();
+  __m256i erro = _mm256_setzero_si256();
+  int num_cont = 0;
+  int p = 0;
+  for (; p + 32 <= nbytes; p += 32) {
+    __m256i bloco = _mm256_loadu_si256((__m256i *)(ptr + p));
+    if (_mm256_movemask_epi8(bloco) == 0) {
+      erro = _mm256_or_si256(erro, incompleto);
+      incompleto = _mm256_setzero_si256();
+      anterior = bloco;
+      continue;
+    }
+    // alignr do avx2 funciona em cada metade de 128 bits; a metade baixa
+    //   precisa do final da metade alta do bloco anterior
+    __m256i meio = _mm256_permute2x128_si256(anterior, bloco, 0x21);
+    __m256i ant1 = _mm256_alignr_epi8(bloco, meio, 16 - 1);
+    __m256i ant2 = _mm256_alignr_epi8(bloco, meio, 16 - 2);
+    __m256i ant3 = _mm256_alignr_epi8(bloco, meio, 16 - 3);
+    __m256i b1_alto = _mm256_shuffle_epi8(tab_b1_alto,
+                        _mm256_and_si256(_mm256_srli_epi16(ant1, 4), nibble));
+    __m256i b1_baixo = _mm256_shuffle_epi8(tab_b1_baixo, _mm256_and_si256(ant1, nibble));
+    __m256i b2_alto = _mm256_shuffle_epi8(tab_b2_alto,
+                        _mm256_and_si256(_mm256_srli_epi16(bloco, 4), nibble));
+    __m256i classe = _mm256_and_si256(_mm256_and_si256(b1_alto, b1_baixo), b2_alto);
+    __m256i deve_cont = _mm256_or_si256(_mm256_subs_epu8(ant2, lim_3),
+                                        _mm256_subs_epu8(ant3, lim_4));
+    deve_cont = _mm256_and_si256(deve_cont, bit_alto);
+    erro = _mm256_or_si256(erro, _mm256_xor_si256(deve_cont, classe));
+    incompleto = _mm256_subs_epu8(bloco, max_fim);
+    num_cont += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(lim_cont, bloco)));
+    anterior = bloco;
+  }
+  if (!_mm256_testz_si256(erro, erro)) return -1;
+  return u8_conta_final(ptr, nbytes, p, p - num_cont);
+}
+#endif // U8_SIMD_X86
+
+// escolhe a implementação da contagem na primeira chamada, de acordo com
+//   o que o processador suporta
+static int u8_conta_escolhe(byte *ptr, int nbytes);
+static int (*u8_conta_impl)(byte *ptr, int nbytes) = u8_conta_escolhe;
+
+static int u8_conta_escolhe(byte *ptr, int nbytes)
+{
+  u8_conta_impl = u8_conta_escalar;
+#ifdef U8_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    u8_conta_impl = u8_conta_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    u8_conta_impl = u8_conta_sse;
+  }
+#endif
+  return u8_conta_impl(ptr, nbytes);
 }
 
 int u8_conta_unichar_nos_bytes(byte *ptr, int nbytes)
+{
+  return u8_conta_impl(ptr, nbytes);
+}
+
+// contagem, avanço e recuo sem verificação {{{1
+
+// Em utf8 válido, cada caractere tem exatamente um byte que não é de
+//   continuação, então contar caracteres é contar esses bytes.
+// Para processar 8 bytes de cada vez, os bytes são lidos em um inteiro de
+//   64 bits; um byte é de continuação se seu bit 7 é 1 e o bit 6 é 0.
+
+#define U8_BITS_ALTOS 0x8080808080808080ull
+
+// retorna um inteiro com o bit 7 de cada byte em 1 se o byte correspondente
+//   em p é o início de um caractere (não é de continuação)
+static inline uint64_t u8_inicios_em_8_bytes(byte *p)
+{
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return ~(w & ~(w << 1)) & U8_BITS_ALTOS;
+}
+
+// retorna quantos bits 7 estão em 1 em uma máscara de u8_inicios_em_8_bytes
+static inline int u8_conta_bits_altos(uint64_t m)
+{
+  return ((m >> 7) * 0x0101010101010101ull) >> 56;
+}
+
+int u8_conta_unichar_sem_verificar(byte *ptr, int nbytes)
 {
   int num_uni = 0;
-  while (nbytes > 0) {
-    int nb1 = u8_unichar_nos_bytes(ptr, nbytes, NULL);
-    if (nb1 < 1) return -1;
-    num_uni++;
-    ptr += nb1;
-    nbytes -= nb1;
+  int p = 0;
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+  // conta os bytes de continuação em 16 contadores de 8 bits, que são
+  //   somados a cada 255 blocos (antes que possam estourar)
+  const __m128i lim_cont = _mm_set1_epi8(-64);
+  int num_cont = 0;
+  while (p + 16 <= nbytes) {
+    __m128i soma = _mm_setzero_si128();
+    for (int i = 0; i < 255 && p + 16 <= nbytes; i++, p += 16) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      soma = _mm_sub_epi8(soma, _mm_cmplt_epi8(bloco, lim_cont));
+    }
+    __m128i soma64 = _mm_sad_epu8(soma, _mm_setzero_si128());
+    num_cont += _mm_cvtsi128_si32(soma64) + _mm_extract_epi16(soma64, 4);
+  }
+  num_uni = p - num_cont;
+#endif
+  for (; p + 8 <= nbytes; p += 8) {
+    num_uni += u8_conta_bits_altos(u8_inicios_em_8_bytes(ptr + p));
+  }
+  for (; p < nbytes; p++) {
+    if (!u8_byte_de_continuacao(ptr[p])) num_uni++;
   }
   return num_uni;
 }
 
+byte *u8_avanca_unichar_sem_verificar(byte *ptr, int nbytes, int n)
+{
+  byte *p = ptr;
+  byte *fim = ptr + nbytes;
+  // pula de 8 em 8 bytes enquanto o caractere procurado não está neles
+  while (fim - p >= 8) {
+    int inicios = u8_conta_bits_altos(u8_inicios_em_8_bytes(p));
+    if (inicios > n) break;
+    n -= inicios;
+    p += 8;
+  }
+  // chegou no bloco onde está o caractere (ou no final); pode estar no
+  //   meio de um caractere que iniciou antes
+  while (p < fim) {
+    if (!u8_byte_de_continuacao(*p)) {
+      if (n == 0) break;
+      n--;
+    }
+    p++;
+  }
+  return p;
+}
+
+byte *u8_recua_unichar(byte *ptr, int nbytes, int n)
+{
+  byte *p = ptr;
+  byte *inicio = ptr - nbytes;
+  if (n <= 0) return p;
+  // recua de 8 em 8 bytes enquanto o caractere procurado não está neles
+  while (p - inicio >= 8) {
+    int inicios = u8_conta_bits_altos(u8_inicios_em_8_bytes(p - 8));
+    if (inicios >= n) break;
+    n -= inicios;
+    p -= 8;
+  }
+  while (p > inicio) {
+    p--;
+    if (!u8_byte_de_continuacao(*p)) {
+      n--;
+      if (n == 0) break;
+    }
+  }
+  return p;
+}
+
+// verificação em partes {{{1
+
+// retorna true se os n bytes em s, que são menos que o necessário para o
+//   caractere que iniciam, podem ser o início de um caractere válido
+// só o 2o byte tem valores restritos (nas sequências que iniciam com E0, ED,
+//   F0 e F4), e cada faixa permitida inclui 0x80 ou 0xBF; então basta testar
+//   completando o caractere com esses valores
+static bool u8_inicio_valido(byte *s, int n)
+{
+  int nb = u8_bytes_no_unichar_que_comeca_com(s[0]);
+  if (nb < 1 || n >= nb) return false;
+  byte buf[4];
+  memcpy(buf, s, n);
+  memset(buf + n, 0x80, nb - n);
+  if (u8_unichar_nos_bytes(buf, nb, NULL) == nb) return true;
+  memset(buf + n, 0xBF, nb - n);
+  return u8_unichar_nos_bytes(buf, nb, NULL) == nb;
+}
+
+// registra um erro na posição pos (contada a partir do início da primeira parte)
+static bool u8_verificador_erro(u8_verificador_t *ver, long long pos)
+{
+  ver->pos_erro = pos;
+  return false;
+}
+
+void u8_verificador_inicia(u8_verificador_t *ver)
+{
+  ver->nbytes = 0;
+  ver->nchars = 0;
+  ver->pos_erro = -1;
+  ver->npendente = 0;
+}
+
+bool u8_verificador_processa(u8_verificador_t *ver, byte *ptr, int nbytes)
+{
+  if (ver->pos_erro != -1) return false;
+
+  // completa o caractere que ficou pendente na parte anterior
+  if (ver->npendente > 0) {
+    int nb = u8_bytes_no_unichar_que_comeca_com(ver->pendente[0]);
+    int n = nb - ver->npendente;
+    if (n > nbytes) n = nbytes;
+    memcpy(ver->pendente + ver->npendente, ptr, n);
+    ver->npendente += n;
+    ptr += n;
+    nbytes -= n;
+    if (ver->npendente < nb) {
+      // ainda não completou (a parte era muito pequena)
+      if (!u8_inicio_valido(ver->pendente, ver->npendente)) {
+        return u8_verificador_erro(ver, ver->nbytes);
+      }
+      return true;
+    }
+    if (u8_unichar_nos_bytes(ver->pendente, nb, NULL) != nb) {
+      return u8_verificador_erro(ver, ver->nbytes);
+    }
+    ver->nbytes += nb;
+    ver->nchars++;
+    ver->npendente = 0;
+  }
+
+  // separa o último caractere se ele não termina nesta parte
+  int fim = nbytes;
+  int ini_ult = nbytes;
+  while (ini_ult > 0 && nbytes - ini_ult < 3 && u8_byte_de_continuacao(ptr[ini_ult - 1])) {
+    ini_ult--;
+  }
+  if (ini_ult > 0) {
+    ini_ult--;
+    if (u8_inicio_valido(ptr + ini_ult, nbytes - ini_ult)) fim = ini_ult;
+  }
+
+  // verifica o restante
+  int nchars = u8_conta_unichar_nos_bytes(ptr, fim);
+  if (nchars == -1) {
+    // acha onde está o erro
+    int p = 0;
+    int nb1;
+    while ((nb1 = u8_unichar_nos_bytes(ptr + p, fim - p, NULL)) > 0) p += nb1;
+    return u8_verificador_erro(ver, ver->nbytes + p);
+  }
+  ver->nbytes += fim;
+  ver->nchars += nchars;
+  ver->npendente = nbytes - fim;
+  memcpy(ver->pendente, ptr + fim, ver->npendente);
+  return true;
+}
+
+bool u8_verificador_termina(u8_verificador_t *ver)
+{
+  if (ver->pos_erro == -1 && ver->npendente > 0) {
+    u8_verificador_erro(ver, ver->nbytes);
+  }
+  return ver->pos_erro == -1;
+}
+
+// largura em terminal {{{1
+
+// consulta o valor de uni em uma tabela de dois níveis gerada por
+//   gera_tabelas.py, com 2 bits por código, em blocos de 2^bits_bloco códigos
+// uni deve ser menor que 0x40000 (o limite das tabelas)
+static inline int u8_consulta_tabela(const byte *indice, const byte *blocos,
+                                     int bits_bloco, unichar uni)
+{
+  int bloco = indice[uni >> bits_bloco];
+  int i = uni & ((1 << bits_bloco) - 1);
+  int bytes_por_bloco = (1 << bits_bloco) / 4;
+  return (blocos[bloco * bytes_por_bloco + i / 4] >> (i % 4 * 2)) & 3;
+}
+
+// como u8_consulta_tabela, para tabelas com um byte por código
+static inline int u8_consulta_tabela8(const byte *indice, const byte *blocos,
+                                      int bits_bloco, unichar uni)
+{
+  int bloco = indice[uni >> bits_bloco];
+  int i = uni & ((1 << bits_bloco) - 1);
+  return blocos[(bloco << bits_bloco) + i];
+}
+
+int u8_largura(unichar uni)
+{
+  if (uni < 0x40000) {
+    return u8_consulta_tabela(u8_tab_largura_indice, &u8_tab_largura_blocos[0][0],
+                              U8_TAB_LARGURA_BITS_BLOCO, uni);
+  }
+  // acima dos planos das tabelas, só os marcadores e seletores de
+  //   variação do plano 14 não ocupam coluna
+  if (uni >= 0xE0000 && uni <= 0xE0FFF) return 0;
+  return 1;
+}
+
+int u8_largura_bloco(byte *ptr, int nbytes)
+{
+  int larg = 0;
+  int p = 0;
+  while (p < nbytes) {
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+    // blocos de 16 caracteres ASCII visíveis (0x20 a 0x7E) ocupam 16 colunas
+    if (p + 16 <= nbytes) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      __m128i visiveis = _mm_and_si128(_mm_cmpgt_epi8(bloco, _mm_set1_epi8(0x1F)),
+                                       _mm_cmplt_epi8(bloco, _mm_set1_epi8(0x7F)));
+      if (_mm_movemask_epi8(visiveis) == 0xFFFF) {
+        larg += 16;
+        p += 16;
+        continue;
+      }
+    }
+#endif
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    larg += u8_largura(uni);
+    p += nb1;
+  }
+  return larg;
+}
+
+int u8_unichar_na_largura(byte *ptr, int nbytes, int larg)
+{
+  int n = 0;
+  int p = 0;
+  while (p < nbytes) {
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    larg -= u8_largura(uni);
+    if (larg < 0) break;
+    n++;
+    p += nb1;
+  }
+  return n;
+}
+
+// classes de caracteres {{{1
+
+u8_classe_t u8_classe(unichar uni)
+{
+  if (uni < 0x40000) {
+    return u8_consulta_tabela(u8_tab_classe_indice, &u8_tab_classe_blocos[0][0],
+                              U8_TAB_CLASSE_BITS_BLOCO, uni);
+  }
+  // acima dos planos das tabelas: marcadores e seletores de variação
+  //   (plano 14) e áreas privadas são considerados parte de palavras
+  return u8_palavra;
+}
+
+// retorna a classe de uni, considerando que, se grande for true, só
+//   existem duas classes: espaço e não espaço
+static u8_classe_t u8_classe_equivalente(unichar uni, bool grande)
+{
+  u8_classe_t classe = u8_classe(uni);
+  if (grande && classe != u8_espaco) return u8_palavra;
+  return classe;
+}
+
+byte *u8_avanca_classe(byte *ptr, int nbytes, bool grande, int *pnchars)
+{
+  int p = 0;
+  int n = 0;
+  u8_classe_t classe_inicial = u8_espaco;
+  while (p < nbytes) {
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    u8_classe_t classe = u8_classe_equivalente(uni, grande);
+    if (n == 0) classe_inicial = classe;
+    else if (classe != classe_inicial) break;
+    p += nb1;
+    n++;
+  }
+  if (pnchars != NULL) *pnchars = n;
+  return ptr + p;
+}
+
+byte *u8_recua_classe(byte *ptr, int nbytes, bool grande, int *pnchars)
+{
+  byte *p = ptr;
+  byte *inicio = ptr - nbytes;
+  int n = 0;
+  u8_classe_t classe_inicial = u8_espaco;
+  while (p > inicio) {
+    byte *ant = u8_recua_unichar(p, p - inicio, 1);
+    unichar uni;
+    if (u8_unichar_nos_bytes(ant, p - ant, &uni) < 1) break;
+    u8_classe_t classe = u8_classe_equivalente(uni, grande);
+    if (n == 0) classe_inicial = classe;
+    else if (classe != classe_inicial) break;
+    p = ant;
+    n++;
+  }
+  if (pnchars != NULL) *pnchars = n;
+  return p;
+}
+
+// conversão de caixa {{{1
+
+// retorna a diferença entre o código convertido e uni, na tabela de caixa
+//   dada (as tabelas de caixa têm um byte por código, o índice da diferença)
+static inline int u8_delta_caixa(const byte *indice, const byte *blocos,
+                                 int bits_bloco, unichar uni)
+{
+  if (uni >= 0x40000) return 0;
+  return u8_tab_caixa_deltas[u8_consulta_tabela8(indice, blocos, bits_bloco, uni)];
+}
+
+unichar u8_maiuscula(unichar uni)
+{
+  if (uni < 0x80) return (uni >= 'a' && uni <= 'z') ? uni - 0x20 : uni;
+  return uni + u8_delta_caixa(u8_tab_maiuscula_indice, &u8_tab_maiuscula_blocos[0][0],
+                              U8_TAB_MAIUSCULA_BITS_BLOCO, uni);
+}
+
+unichar u8_minuscula(unichar uni)
+{
+  if (uni < 0x80) return (uni >= 'A' && uni <= 'Z') ? uni + 0x20 : uni;
+  return uni + u8_delta_caixa(u8_tab_minuscula_indice, &u8_tab_minuscula_blocos[0][0],
+                              U8_TAB_MINUSCULA_BITS_BLOCO, uni);
+}
+
+unichar u8_altera_caixa(unichar uni, u8_caixa_t caixa)
+{
+  switch (caixa) {
+    case u8_caixa_alta: return u8_maiuscula(uni);
+    case u8_caixa_baixa: return u8_minuscula(uni);
+    case u8_caixa_alternada: {
+      unichar min = u8_minuscula(uni);
+      if (min != uni) return min;
+      return u8_maiuscula(uni);
+    }
+  }
+  return uni;
+}
+
+// converte a caixa de um caractere ASCII
+// as letras a converter são as que, depois de um "ou" com mascara, estão
+//   entre primeira e primeira+25; a conversão troca o bit 0x20
+static inline byte u8_altera_caixa_ascii(byte b, byte mascara, byte primeira)
+{
+  byte l = b | mascara;
+  if (l >= primeira && l < primeira + 26) return b ^ 0x20;
+  return b;
+}
+
+// calcula mascara e primeira para u8_altera_caixa_ascii
+static void u8_parametros_caixa_ascii(u8_caixa_t caixa, byte *mascara, byte *primeira)
+{
+  *mascara = 0;
+  *primeira = (caixa == u8_caixa_baixa) ? 'A' : 'a';
+  // 'A' | 0x20 == 'a': as duas caixas caem na mesma faixa
+  if (caixa == u8_caixa_alternada) *mascara = 0x20;
+}
+
+int u8_altera_caixa_no_lugar(byte *ptr, int nbytes, u8_caixa_t caixa)
+{
+  byte mascara, primeira;
+  u8_parametros_caixa_ascii(caixa, &mascara, &primeira);
+  int p = 0;
+  while (p < nbytes) {
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+    // blocos de 16 bytes ASCII: desloca a faixa das letras para o início
+    //   da faixa com sinal (-128 a -103) para poder usar a comparação com sinal
+    if (p + 16 <= nbytes) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      if (_mm_movemask_epi8(bloco) == 0) {
+        __m128i l = _mm_or_si128(bloco, _mm_set1_epi8(mascara));
+        __m128i d = _mm_add_epi8(l, _mm_set1_epi8((char)(0x80 - primeira)));
+        __m128i letras = _mm_cmplt_epi8(d, _mm_set1_epi8(-128 + 26));
+        bloco = _mm_xor_si128(bloco, _mm_and_si128(letras, _mm_set1_epi8(0x20)));
+        _mm_storeu_si128((__m128i *)(ptr + p), bloco);
+        p += 16;
+        continue;
+      }
+    }
+#endif
+    if (ptr[p] < 0x80) {
+      ptr[p] = u8_altera_caixa_ascii(ptr[p], mascara, primeira);
+      p++;
+      continue;
+    }
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    unichar novo = u8_altera_caixa(uni, caixa);
+    if (novo != uni) {
+      byte buf[4];
+      if (u8_converte_pra_utf8(novo, buf) != nb1) break;
+      memcpy(ptr + p, buf, nb1);
+    }
+    p += nb1;
+  }
+  return p;
+}
+
+int u8_altera_caixa_bloco(byte *ptr, int nbytes, byte *buf, u8_caixa_t caixa)
+{
+  byte mascara, primeira;
+  u8_parametros_caixa_ascii(caixa, &mascara, &primeira);
+  byte *b = buf;
+  int p = 0;
+  while (p < nbytes) {
+    if (ptr[p] < 0x80) {
+      *b++ = u8_altera_caixa_ascii(ptr[p], mascara, primeira);
+      p++;
+      continue;
+    }
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    b += u8_converte_pra_utf8(u8_altera_caixa(uni, caixa), b);
+    p += nb1;
+  }
+  return b - buf;
+}
+
+// normalização NFC {{{1
+
+// o hangul é decomposto e composto por algoritmo
+#define HANGUL_S 0xAC00
+#define HANGUL_L 0x1100
+#define HANGUL_V 0x1161
+#define HANGUL_T 0x11A7
+#define HANGUL_NV 21
+#define HANGUL_NT 28
+#define HANGUL_NS (19 * HANGUL_NV * HANGUL_NT)
+
+// resultado da verificação rápida de NFC para um caractere: 0 se certamente
+//   está em NFC e não se combina com o anterior; diferente de 0 se pode
+//   precisar de normalização (ver nfc_rapido em gera_tabelas.py)
+static inline int u8_nfc_rapido(unichar uni)
+{
+  if (uni < 0x300 || uni >= 0x40000) return 0;
+  return u8_consulta_tabela(u8_tab_nfc_indice, &u8_tab_nfc_blocos[0][0],
+                            U8_TAB_NFC_BITS_BLOCO, uni);
+}
+
+// retorna a classe de combinação canônica de uni
+static inline int u8_ccc(unichar uni)
+{
+  if (uni < 0x300 || uni >= 0x40000) return 0;
+  return u8_consulta_tabela8(u8_tab_ccc_indice, &u8_tab_ccc_blocos[0][0],
+                             U8_TAB_CCC_BITS_BLOCO, uni);
+}
+
+// coloca em dec a decomposição canônica completa de uni
+// retorna o número de caracteres colocados (no máximo U8_TAB_DECOMP_MAX)
+static int u8_decompoe(unichar uni, unichar *dec)
+{
+  if (uni >= HANGUL_S && uni < HANGUL_S + HANGUL_NS) {
+    int s = uni - HANGUL_S;
+    dec[0] = HANGUL_L + s / (HANGUL_NV * HANGUL_NT);
+    dec[1] = HANGUL_V + s % (HANGUL_NV * HANGUL_NT) / HANGUL_NT;
+    if (s % HANGUL_NT == 0) return 2;
+    dec[2] = HANGUL_T + s % HANGUL_NT;
+    return 3;
+  }
+  // busca binária na tabela de decomposição
+  int ini = 0;
+  int fim = sizeof(u8_tab_decomp_codigos) / sizeof(u8_tab_decomp_codigos[0]);
+  while (ini < fim) {
+    int meio = (ini + fim) / 2;
+    if (u8_tab_decomp_codigos[meio] < uni) ini = meio + 1;
+    else fim = meio;
+  }
+  if (ini == sizeof(u8_tab_decomp_codigos) / sizeof(u8_tab_decomp_codigos[0])
+      || u8_tab_decomp_codigos[ini] != uni) {
+    dec[0] = uni;
+    return 1;
+  }
+  int n = u8_tab_decomp_inicio[ini + 1] - u8_tab_decomp_inicio[ini];
+  memcpy(dec, &u8_tab_decomp_seq[u8_tab_decomp_inicio[ini]], n * sizeof(unichar));
+  return n;
+}
+
+// retorna o caractere composto por primeiro seguido de segundo, ou 0 se não
+//   houver composição
+static unichar u8_compoe(unichar primeiro, unichar segundo)
+{
+  if (primeiro >= HANGUL_L && primeiro < HANGUL_L + 19
+      && segundo >= HANGUL_V && segundo < HANGUL_V + HANGUL_NV) {
+    return HANGUL_S + ((primeiro - HANGUL_L) * HANGUL_NV + segundo - HANGUL_V) * HANGUL_NT;
+  }
+  if (primeiro >= HANGUL_S && primeiro < HANGUL_S + HANGUL_NS
+      && (primeiro - HANGUL_S) % HANGUL_NT == 0
+      && segundo > HANGUL_T && segundo < HANGUL_T + HANGUL_NT) {
+    return primeiro + segundo - HANGUL_T;
+  }
+  unsigned long long par = (unsigned long long)primeiro << 21 | segundo;
+  int ini = 0;
+  int fim = sizeof(u8_tab_comp_pares) / sizeof(u8_tab_comp_pares[0]);
+  while (ini < fim) {
+    int meio = (ini + fim) / 2;
+    if (u8_tab_comp_pares[meio] < par) ini = meio + 1;
+    else fim = meio;
+  }
+  if (ini < (int)(sizeof(u8_tab_comp_pares) / sizeof(u8_tab_comp_pares[0]))
+      && u8_tab_comp_pares[ini] == par) {
+    return u8_tab_comp_compostos[ini];
+  }
+  return 0;
+}
+
+// normaliza os nbytes em ptr, que não contêm início de caractere que passe
+//   na verificação rápida, exceto talvez o primeiro: decompõe, ordena as
+//   marcas de combinação e compõe
+// coloca o resultado em buf, retorna o número de bytes colocados
+static int u8_normaliza_segmento(byte *ptr, int nbytes, byte *buf)
+{
+  // decomposição
+  unichar unis_locais[64];
+  unichar *unis = unis_locais;
+  if (nbytes * U8_TAB_DECOMP_MAX > 64) {
+    unis = malloc(nbytes * U8_TAB_DECOMP_MAX * sizeof(unichar));
+    assert(unis != NULL);
+  }
+  int n = 0;
+  int p = 0;
+  while (p < nbytes) {
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    n += u8_decompoe(uni, unis + n);
+    p += nb1;
+  }
+  // ordenação canônica: as marcas de combinação entre dois iniciais ficam em
+  //   ordem crescente de classe (ordenação estável, por inserção)
+  for (int i = 1; i < n; i++) {
+    int ccc = u8_ccc(unis[i]);
+    if (ccc == 0) continue;
+    unichar uni = unis[i];
+    int j = i;
+    while (j > 0 && u8_ccc(unis[j - 1]) > ccc) {
+      unis[j] = unis[j - 1];
+      j--;
+    }
+    unis[j] = uni;
+  }
+  // composição: cada caractere é composto com o último inicial, se não
+  //   houver entre eles um caractere com classe 0 ou maior ou igual à sua
+  int inicial = -1;
+  int ult_ccc = 0;
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    unichar uni = unis[i];
+    int ccc = u8_ccc(uni);
+    if (inicial >= 0 && (m - 1 == inicial || ult_ccc < ccc)) {
+      unichar composto = u8_compoe(unis[inicial], uni);
+      if (composto != 0) {
+        unis[inicial] = composto;
+        continue;
+      }
+    }
+    if (ccc == 0) inicial = m;
+    ult_ccc = ccc;
+    unis[m++] = uni;
+  }
+  int nbuf = u8_codifica_bloco(unis, m, buf);
+  if (unis != unis_locais) free(unis);
+  return nbuf;
+}
+
+int u8_prefixo_nfc(byte *ptr, int nbytes)
+{
+  int p = 0;
+  while (p < nbytes) {
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+    // blocos de 16 bytes menores que 0xCC só têm caracteres abaixo de
+    //   U+0300, que estão todos em NFC
+    if (p + 16 <= nbytes) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      __m128i lim = _mm_set1_epi8((char)0xCB);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(bloco, lim), lim)) == 0xFFFF) {
+        p += 16;
+        continue;
+      }
+    }
+#endif
+    if (ptr[p] < 0xCC) {
+      p++;
+      continue;
+    }
+    // o utf8 é válido: os caracteres de 2 e 3 bytes são decodificados
+    //   diretamente
+    unichar uni;
+    int nb1;
+    if (ptr[p] < 0xE0 && p + 1 < nbytes) {
+      uni = (ptr[p] & 0x1F) << 6 | (ptr[p + 1] & 0x3F);
+      nb1 = 2;
+    } else if (ptr[p] < 0xF0 && p + 2 < nbytes) {
+      uni = (ptr[p] & 0x0F) << 12 | (ptr[p + 1] & 0x3F) << 6 | (ptr[p + 2] & 0x3F);
+      nb1 = 3;
+    } else {
+      nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+      if (nb1 < 1) {
+        p++;
+        continue;
+      }
+    }
+    if (u8_nfc_rapido(uni) != 0) {
+      // o caractere anterior pode se combinar com este
+      if (p == 0) return 0;
+      return u8_recua_unichar(ptr + p, p, 1) - ptr;
+    }
+    p += nb1;
+  }
+  return nbytes;
+}
+
+int u8_normaliza_nfc(byte *ptr, int nbytes, byte *buf)
+{
+  byte *b = buf;
+  int p = 0;
+  while (p < nbytes) {
+    // copia o trecho que já está em NFC
+    int n = u8_prefixo_nfc(ptr + p, nbytes - p);
+    memcpy(b, ptr + p, n);
+    b += n;
+    p += n;
+    if (p >= nbytes) break;
+    // o trecho a normalizar vai até antes do próximo caractere que passa
+    //   na verificação rápida
+    int fim = p + u8_bytes_no_unichar_que_comeca_com(ptr[p]);
+    while (fim < nbytes) {
+      unichar uni;
+      int nb1 = u8_unichar_nos_bytes(ptr + fim, nbytes - fim, &uni);
+      if (nb1 < 1 || u8_nfc_rapido(uni) == 0) break;
+      fim += nb1;
+    }
+    if (fim > nbytes) fim = nbytes;
+    b += u8_normaliza_segmento(ptr + p, fim - p, b);
+    p = fim;
+  }
+  return b - buf;
+}
+
+// outras funções {{{1
+
 byte *u8_avanca_unichar(byte *ptr, int n)
 {
   byte *p = ptr;
@@ -146,3 +1116,590 @@ int u8_converte_pra_utf8(unichar uni, byte *buf)
     return 4;
   }
 }
+
+// conversão em bloco {{{1
+
+int u8_decodifica_bloco(byte *ptr, int nbytes, unichar *unis, int max_unis, int *pnbytes)
+{
+  int p = 0;
+  int n = 0;
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+  // expande blocos de 16 bytes ASCII para 16 códigos de 32 bits
+  const __m128i zero = _mm_setzero_si128();
+  while (p + 16 <= nbytes && n + 16 <= max_unis) {
+    __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+    if (_mm_movemask_epi8(bloco) != 0) {
+      // tem não ASCII; decodifica esse trecho um a um
+      int lim = p + 16;
+      while (p < lim && n < max_unis) {
+        int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &unis[n]);
+        if (nb1 < 1) goto erro;
+        p += nb1;
+        n++;
+      }
+      continue;
+    }
+    __m128i baixo = _mm_unpacklo_epi8(bloco, zero);
+    __m128i alto = _mm_unpackhi_epi8(bloco, zero);
+    _mm_storeu_si128((__m128i *)(unis + n),      _mm_unpacklo_epi16(baixo, zero));
+    _mm_storeu_si128((__m128i *)(unis + n + 4),  _mm_unpackhi_epi16(baixo, zero));
+    _mm_storeu_si128((__m128i *)(unis + n + 8),  _mm_unpacklo_epi16(alto, zero));
+    _mm_storeu_si128((__m128i *)(unis + n + 12), _mm_unpackhi_epi16(alto, zero));
+    p += 16;
+    n += 16;
+  }
+#endif
+  while (p < nbytes && n < max_unis) {
+    if (ptr[p] < 0x80) {
+      unis[n++] = ptr[p++];
+      continue;
+    }
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &unis[n]);
+    if (nb1 < 1) goto erro;
+    p += nb1;
+    n++;
+  }
+  if (pnbytes != NULL) *pnbytes = p;
+  return n;
+erro:
+  if (pnbytes != NULL) *pnbytes = p;
+  return -1;
+}
+
+int u8_codifica_bloco(unichar *unis, int nunis, byte *buf)
+{
+  int i = 0;
+  byte *b = buf;
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+  // comprime blocos de 16 códigos ASCII para 16 bytes
+  const __m128i nao_ascii = _mm_set1_epi32(~0x7F);
+  const __m128i zero = _mm_setzero_si128();
+  while (i + 16 <= nunis) {
+    __m128i u0 = _mm_loadu_si128((__m128i *)(unis + i));
+    __m128i u1 = _mm_loadu_si128((__m128i *)(unis + i + 4));
+    __m128i u2 = _mm_loadu_si128((__m128i *)(unis + i + 8));
+    __m128i u3 = _mm_loadu_si128((__m128i *)(unis + i + 12));
+    __m128i todos = _mm_or_si128(_mm_or_si128(u0, u1), _mm_or_si128(u2, u3));
+    __m128i acima = _mm_cmpeq_epi32(_mm_and_si128(todos, nao_ascii), zero);
+    if (_mm_movemask_epi8(acima) != 0xFFFF) {
+      // tem não ASCII; codifica esse trecho um a um
+      for (int lim = i + 16; i < lim; i++) {
+        b += u8_converte_pra_utf8(unis[i], b);
+      }
+      continue;
+    }
+    __m128i baixo = _mm_packs_epi32(u0, u1);
+    __m128i alto = _mm_packs_epi32(u2, u3);
+    _mm_storeu_si128((__m128i *)b, _mm_packus_epi16(baixo, alto));
+    i += 16;
+    b += 16;
+  }
+#endif
+  for (; i < nunis; i++) {
+    if (unis[i] < 0x80) {
+      *b++ = unis[i];
+    } else {
+      b += u8_converte_pra_utf8(unis[i], b);
+    }
+  }
+  return b - buf;
+}
+
+// conjuntos de caracteres {{{1
+
+// compara dois unichar, para qsort
+static int u8_compara_unichar(const void *a, const void *b)
+{
+  unichar ua = *(const unichar *)a;
+  unichar ub = *(const unichar *)b;
+  return (ua > ub) - (ua < ub);
+}
+
+// acrescenta b aos bytes que iniciam caracteres de *conj
+// se passar de 16, n_gatilhos fica maior que 16 e a lista não é mais usada
+static void u8_conjunto_gatilho(u8_conjunto_t *conj, byte b)
+{
+  int n = conj->n_gatilhos;
+  if (n > 16) return;
+  if (memchr(conj->gatilhos, b, n) != NULL) return;
+  if (n < 16) conj->gatilhos[n] = b;
+  conj->n_gatilhos++;
+}
+
+// retorna o vetor com os caracteres não ASCII de *conj
+static unichar *u8_conjunto_outros(u8_conjunto_t *conj)
+{
+  if (conj->outros_alocados != NULL) return conj->outros_alocados;
+  return conj->outros_locais;
+}
+
+void u8_conjunto_inicia(u8_conjunto_t *conj, byte *ptr, int nbytes)
+{
+  conj->ascii[0] = conj->ascii[1] = 0;
+  conj->n_gatilhos = 0;
+  conj->n_outros = 0;
+  conj->outros_alocados = NULL;
+  unichar *outros = conj->outros_locais;
+  int cap = U8_CONJ_LOCAIS;
+  int p = 0;
+  while (p < nbytes) {
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) break;
+    p += nb1;
+    u8_conjunto_gatilho(conj, ptr[p - nb1]);
+    if (uni < 0x80) {
+      conj->ascii[uni / 64] |= 1ull << (uni % 64);
+      continue;
+    }
+    if (conj->n_outros == cap) {
+      cap *= 2;
+      if (conj->outros_alocados == NULL) {
+        conj->outros_alocados = malloc(cap * sizeof(unichar));
+        assert(conj->outros_alocados != NULL);
+        memcpy(conj->outros_alocados, conj->outros_locais, sizeof(conj->outros_locais));
+      } else {
+        unichar *novos = realloc(conj->outros_alocados, cap * sizeof(unichar));
+        assert(novos != NULL);
+        conj->outros_alocados = novos;
+      }
+      outros = conj->outros_alocados;
+    }
+    outros[conj->n_outros++] = uni;
+  }
+  // ordena e elimina as repetições, para a busca binária
+  qsort(outros, conj->n_outros, sizeof(unichar), u8_compara_unichar);
+  int n = 0;
+  for (int i = 0; i < conj->n_outros; i++) {
+    if (n == 0 || outros[n - 1] != outros[i]) outros[n++] = outros[i];
+  }
+  conj->n_outros = n;
+}
+
+void u8_conjunto_libera(u8_conjunto_t *conj)
+{
+  free(conj->outros_alocados);
+  conj->outros_alocados = NULL;
+}
+
+bool u8_conjunto_contem(u8_conjunto_t *conj, unichar uni)
+{
+  if (uni < 0x80) return (conj->ascii[uni / 64] >> (uni % 64)) & 1;
+  unichar *outros = u8_conjunto_outros(conj);
+  int ini = 0;
+  int fim = conj->n_outros;
+  while (ini < fim) {
+    int meio = (ini + fim) / 2;
+    if (outros[meio] < uni) ini = meio + 1;
+    else fim = meio;
+  }
+  return ini < conj->n_outros && outros[ini] == uni;
+}
+
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+// retorna uma máscara com um bit para cada um dos 16 bytes em ptr, 1 se o
+//   byte é um dos gatilhos de *conj
+// os bytes de continuação nunca são iguais a um gatilho
+static inline int u8_mascara_conjunto(byte *ptr, u8_conjunto_t *conj)
+{
+  __m128i bloco = _mm_loadu_si128((__m128i *)ptr);
+  __m128i iguais = _mm_setzero_si128();
+  for (int i = 0; i < conj->n_gatilhos; i++) {
+    __m128i c = _mm_set1_epi8(conj->gatilhos[i]);
+    iguais = _mm_or_si128(iguais, _mm_cmpeq_epi8(bloco, c));
+  }
+  return _mm_movemask_epi8(iguais);
+}
+#endif
+
+// retorna true se o caractere que inicia em ptr (com no máximo nbytes)
+//   pertence a *conj
+static inline bool u8_conjunto_contem_em(u8_conjunto_t *conj, byte *ptr, int nbytes)
+{
+  if (*ptr < 0x80) return (conj->ascii[*ptr / 64] >> (*ptr % 64)) & 1;
+  if (conj->n_outros == 0) return false;
+  unichar uni;
+  if (u8_unichar_nos_bytes(ptr, nbytes, &uni) < 1) return false;
+  return u8_conjunto_contem(conj, uni);
+}
+
+// a busca vetorizada só serve para procurar os caracteres que pertencem ao
+//   conjunto ou, se ele não tem caracteres não ASCII, os que não pertencem
+//   (qualquer byte não ASCII é então início ou continuação de um caractere
+//   que não pertence)
+static inline bool u8_conjunto_vetorizavel(u8_conjunto_t *conj, bool pertence)
+{
+  if (conj->n_gatilhos > 16) return false;
+  return pertence || conj->n_outros == 0;
+}
+
+byte *u8_busca_conjunto(byte *ptr, int nbytes, u8_conjunto_t *conj, bool pertence)
+{
+  int p = 0;
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+  if (u8_conjunto_vetorizavel(conj, pertence)) {
+    while (p + 16 <= nbytes) {
+      int mascara = u8_mascara_conjunto(ptr + p, conj);
+      // um byte não ASCII que não pertence é sempre o primeiro do caractere
+      if (!pertence) mascara = ~mascara & 0xFFFF;
+      if (mascara == 0) {
+        p += 16;
+        continue;
+      }
+      p += __builtin_ctz(mascara);
+      // um gatilho não ASCII é só um candidato: confere o caractere inteiro
+      if (!pertence || u8_conjunto_contem_em(conj, ptr + p, nbytes - p)) {
+        return ptr + p;
+      }
+      p++;
+    }
+    // continua no início do caractere que pode ter ficado pela metade
+    while (p > 0 && p < nbytes && (ptr[p] & 0xC0) == 0x80) p--;
+  }
+#endif
+  while (p < nbytes) {
+    if (ptr[p] < 0x80) {
+      if (((conj->ascii[ptr[p] / 64] >> (ptr[p] % 64)) & 1) == pertence) return ptr + p;
+      p++;
+      continue;
+    }
+    int nb1;
+    if (conj->n_outros == 0) {
+      // não precisa decodificar: não pertence
+      if (!pertence) return ptr + p;
+      nb1 = u8_bytes_no_unichar_que_comeca_com(ptr[p]);
+    } else {
+      unichar uni;
+      nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+      if (nb1 > 0 && u8_conjunto_contem(conj, uni) == pertence) return ptr + p;
+    }
+    if (nb1 < 1) nb1 = 1;
+    p += nb1;
+  }
+  return NULL;
+}
+
+byte *u8_busca_conjunto_r(byte *ptr, int nbytes, u8_conjunto_t *conj, bool pertence)
+{
+  int p = nbytes;
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+  if (u8_conjunto_vetorizavel(conj, pertence)) {
+    while (p >= 16) {
+      int mascara = u8_mascara_conjunto(ptr + p - 16, conj);
+      if (!pertence) mascara = ~mascara & 0xFFFF;
+      if (mascara == 0) {
+        p -= 16;
+        continue;
+      }
+      byte *achou = ptr + p - 16 + (31 - __builtin_clz(mascara));
+      if (!pertence) {
+        // se for um byte de continuação, o caractere começa antes
+        while (achou > ptr && (*achou & 0xC0) == 0x80) achou--;
+        return achou;
+      }
+      if (u8_conjunto_contem_em(conj, achou, ptr + nbytes - achou)) return achou;
+      p = achou - ptr;
+    }
+    // continua no final do caractere que pode ter ficado pela metade
+    while (p > 0 && p < nbytes && (ptr[p] & 0xC0) == 0x80) p++;
+  }
+#endif
+  while (p > 0) {
+    if (ptr[p - 1] < 0x80) {
+      p--;
+      if (((conj->ascii[ptr[p] / 64] >> (ptr[p] % 64)) & 1) == pertence) return ptr + p;
+      continue;
+    }
+    byte *ant = u8_recua_unichar(ptr + p, p, 1);
+    if (conj->n_outros == 0) {
+      if (!pertence) return ant;
+    } else {
+      unichar uni;
+      if (u8_unichar_nos_bytes(ant, ptr + p - ant, &uni) > 0
+          && u8_conjunto_contem(conj, uni) == pertence) {
+        return ant;
+      }
+    }
+    p = ant - ptr;
+  }
+  return NULL;
+}
+
+// transcodificação {{{1
+
+// caracteres cp1252 de 0x80 a 0x9F (os outros acima de 0x7F são iguais aos
+//   códigos unicode); os códigos não definidos são 0xFFFD
+static const unichar u8_cp1252_80_9F[32] = {
+  0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+  0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
+  0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+  0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178,
+};
+
+u8_codificacao_t u8_detecta_codificacao(byte *ptr, int nbytes)
+{
+  if (nbytes >= 3 && ptr[0] == 0xEF && ptr[1] == 0xBB && ptr[2] == 0xBF) return u8_utf8_bom;
+  if (nbytes >= 2 && ptr[0] == 0xFF && ptr[1] == 0xFE) return u8_utf16le;
+  if (nbytes >= 2 && ptr[0] == 0xFE && ptr[1] == 0xFF) return u8_utf16be;
+  // sem BOM, texto em utf16 tem muitos bytes 0 (a parte alta dos caracteres
+  //   ASCII), quase todos na mesma paridade de posição
+  int n = nbytes < 4096 ? nbytes : 4096;
+  int zeros[2] = { 0, 0 };
+  for (int i = 0; i < n; i++) {
+    if (ptr[i] == 0) zeros[i % 2]++;
+  }
+  if (zeros[1] > n / 8 && zeros[0] < zeros[1] / 8) return u8_utf16le;
+  if (zeros[0] > n / 8 && zeros[1] < zeros[0] / 8) return u8_utf16be;
+  return u8_utf8;
+}
+
+bool u8_parece_utf8(byte *ptr, int nbytes)
+{
+  int validos = 0;
+  int invalidos = 0;
+  int p = 0;
+  while (p < nbytes) {
+    if (ptr[p] < 0x80) {
+      p++;
+      continue;
+    }
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, NULL);
+    if (nb1 < 1) {
+      invalidos++;
+      p++;
+    } else {
+      validos++;
+      p += nb1;
+    }
+  }
+  // em cp1252, é raro que uma sequência de bytes acima de 0x7F seja utf8 válido
+  return validos > invalidos;
+}
+
+// converte de utf8 possivelmente inválido: cada byte que não faz parte de
+//   um caractere válido vira 0xFFFD
+static int u8_de_utf8(byte *ptr, int nbytes, byte *buf)
+{
+  byte *b = buf;
+  int p = 0;
+  while (p < nbytes) {
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+    if (p + 16 <= nbytes) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      if (_mm_movemask_epi8(bloco) == 0) {
+        _mm_storeu_si128((__m128i *)b, bloco);
+        p += 16;
+        b += 16;
+        continue;
+      }
+    }
+#endif
+    if (ptr[p] < 0x80) {
+      *b++ = ptr[p++];
+      continue;
+    }
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, NULL);
+    if (nb1 < 1) {
+      b += u8_converte_pra_utf8(0xFFFD, b);
+      p++;
+    } else {
+      memcpy(b, ptr + p, nb1);
+      b += nb1;
+      p += nb1;
+    }
+  }
+  return b - buf;
+}
+
+// converte de cp1252
+static int u8_de_cp1252(byte *ptr, int nbytes, byte *buf)
+{
+  byte *b = buf;
+  int p = 0;
+  while (p < nbytes) {
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+    if (p + 16 <= nbytes) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      if (_mm_movemask_epi8(bloco) == 0) {
+        _mm_storeu_si128((__m128i *)b, bloco);
+        p += 16;
+        b += 16;
+        continue;
+      }
+    }
+#endif
+    byte c = ptr[p++];
+    if (c < 0x80) {
+      *b++ = c;
+    } else if (c < 0xA0) {
+      b += u8_converte_pra_utf8(u8_cp1252_80_9F[c - 0x80], b);
+    } else {
+      b += u8_converte_pra_utf8(c, b);
+    }
+  }
+  return b - buf;
+}
+
+// converte de utf16 (big endian se be for true); surrogates sem par e um
+//   byte final isolado viram 0xFFFD
+static int u8_de_utf16(byte *ptr, int nbytes, bool be, byte *buf)
+{
+  byte *b = buf;
+  int p = 0;
+  int a = be ? 0 : 1; // posição do byte alto de cada unidade
+  while (p + 1 < nbytes) {
+#if defined(U8_SIMD_X86) && defined(__SSE2__)
+    // 8 unidades ASCII viram 8 bytes
+    if (p + 16 <= nbytes) {
+      __m128i bloco = _mm_loadu_si128((__m128i *)(ptr + p));
+      if (be) bloco = _mm_or_si128(_mm_slli_epi16(bloco, 8), _mm_srli_epi16(bloco, 8));
+      __m128i acima = _mm_and_si128(bloco, _mm_set1_epi16((short)0xFF80));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(acima, _mm_setzero_si128())) == 0xFFFF) {
+        _mm_storel_epi64((__m128i *)b, _mm_packus_epi16(bloco, bloco));
+        p += 16;
+        b += 8;
+        continue;
+      }
+    }
+#endif
+    unichar u = ptr[p + a] << 8 | ptr[p + 1 - a];
+    p += 2;
+    if (u >= 0xD800 && u < 0xDC00 && p + 1 < nbytes) {
+      unichar u2 = ptr[p + a] << 8 | ptr[p + 1 - a];
+      if (u2 >= 0xDC00 && u2 < 0xE000) {
+        u = 0x10000 + ((u - 0xD800) << 10) + (u2 - 0xDC00);
+        p += 2;
+      }
+    }
+    if (u >= 0xD800 && u < 0xE000) u = 0xFFFD;
+    b += u8_converte_pra_utf8(u, b);
+  }
+  if (p < nbytes) b += u8_converte_pra_utf8(0xFFFD, b);
+  return b - buf;
+}
+
+int u8_tira_cr(byte *buf, int nbytes)
+{
+  byte *fim = buf + nbytes;
+  byte *cr = memchr(buf, '\r', nbytes);
+  if (cr == NULL) return nbytes;
+  byte *d = cr;
+  byte *s = cr;
+  while (s < fim) {
+    // copia até o próximo '\r' (inclusive), e o pula se for seguido de '\n'
+    byte *prox = memchr(s + 1, '\r', fim - s - 1);
+    if (prox == NULL) prox = fim;
+    if (s + 1 < fim && s[1] == '\n') s++;
+    memmove(d, s, prox - s);
+    d += prox - s;
+    s = prox;
+  }
+  return d - buf;
+}
+
+int u8_transcodifica(byte *ptr, int nbytes, u8_codificacao_t cod, byte *buf)
+{
+  switch (cod) {
+    case u8_utf8_bom:
+      if (nbytes >= 3 && memcmp(ptr, "\xEF\xBB\xBF", 3) == 0) {
+        ptr += 3;
+        nbytes -= 3;
+      }
+      break;
+    case u8_utf16le:
+    case u8_utf16be: {
+      bool be = cod == u8_utf16be;
+      if (nbytes >= 2 && ptr[0] == (be ? 0xFE : 0xFF) && ptr[1] == (be ? 0xFF : 0xFE)) {
+        ptr += 2;
+        nbytes -= 2;
+      }
+      break;
+    }
+    default: break;
+  }
+  return u8_transcodifica_parte(ptr, nbytes, cod, buf);
+}
+
+int u8_transcodifica_parte(byte *ptr, int nbytes, u8_codificacao_t cod, byte *buf)
+{
+  switch (cod) {
+    case u8_utf16le:
+    case u8_utf16be: return u8_de_utf16(ptr, nbytes, cod == u8_utf16be, buf);
+    case u8_cp1252: return u8_de_cp1252(ptr, nbytes, buf);
+    default: return u8_de_utf8(ptr, nbytes, buf);
+  }
+}
+
+// coloca em buf o caractere uni codificado em cod
+// retorna o número de bytes colocados
+static int u8_codifica_unichar_em(unichar uni, u8_codificacao_t cod, byte *buf)
+{
+  switch (cod) {
+    case u8_utf16le:
+    case u8_utf16be: {
+      int a = cod == u8_utf16be ? 0 : 1;
+      if (uni >= 0x10000) {
+        unichar alto = 0xD800 + ((uni - 0x10000) >> 10);
+        unichar baixo = 0xDC00 + ((uni - 0x10000) & 0x3FF);
+        buf[a] = alto >> 8;
+        buf[1 - a] = alto & 0xFF;
+        buf[2 + a] = baixo >> 8;
+        buf[3 - a] = baixo & 0xFF;
+        return 4;
+      }
+      buf[a] = uni >> 8;
+      buf[1 - a] = uni & 0xFF;
+      return 2;
+    }
+    case u8_cp1252:
+      if (uni < 0x80 || (uni >= 0xA0 && uni < 0x100)) {
+        buf[0] = uni;
+        return 1;
+      }
+      for (int i = 0; i < 32; i++) {
+        if (u8_cp1252_80_9F[i] == uni && uni != 0xFFFD) {
+          buf[0] = 0x80 + i;
+          return 1;
+        }
+      }
+      buf[0] = '?';
+      return 1;
+    default:
+      return u8_converte_pra_utf8(uni, buf);
+  }
+}
+
+int u8_codifica_em(byte *ptr, int nbytes, u8_codificacao_t cod, bool poe_cr, byte *buf)
+{
+  byte *b = buf;
+  if (cod == u8_utf8_bom) {
+    memcpy(b, "\xEF\xBB\xBF", 3);
+    b += 3;
+  } else if (cod == u8_utf16le || cod == u8_utf16be) {
+    b += u8_codifica_unichar_em(0xFEFF, cod, b);
+  }
+  return b - buf + u8_codifica_parte_em(ptr, nbytes, cod, poe_cr, b);
+}
+
+int u8_codifica_parte_em(byte *ptr, int nbytes, u8_codificacao_t cod, bool poe_cr, byte *buf)
+{
+  byte *b = buf;
+  int p = 0;
+  while (p < nbytes) {
+    if (ptr[p] < 0x80) {
+      if (ptr[p] == '\n' && poe_cr) b += u8_codifica_unichar_em('\r', cod, b);
+      b += u8_codifica_unichar_em(ptr[p], cod, b);
+      p++;
+      continue;
+    }
+    unichar uni;
+    int nb1 = u8_unichar_nos_bytes(ptr + p, nbytes - p, &uni);
+    if (nb1 < 1) {
+      uni = 0xFFFD;
+      nb1 = 1;
+    }
+    b += u8_codifica_unichar_em(uni, cod, b);
+    p += nb1;
+  }
+  return b - buf;
+}
@@ -54,6 +54,8 @@ int u8_unichar_nos_bytes(byte *s, int maxn, unichar *puni);
 //   nbytes que iniciam em *ptr
 // faz a verificação da codificação utf8
 // retorna o número de caracteres ou -1 se houver erro na codificação
+// usa instruções vetoriais (SSE4.2 ou AVX2) se o processador tiver, escolhidas
+//   na primeira chamada
 int u8_conta_unichar_nos_bytes(byte *ptr, int nbytes);
 
 // retorna o ponteiro para o primeiro byte do caractere que está
@@ -65,10 +67,257 @@ int u8_conta_unichar_nos_bytes(byte *ptr, int nbytes);
 // não tem suporte a n negativo
 byte *u8_avanca_unichar(byte *ptr, int n);
 
+// versões sem verificação, para regiões que se sabe conter utf8 válido (o
+//   conteúdo de uma str, por exemplo)
+// processam vários bytes de cada vez, contando os bytes que não são de
+//   continuação
+
+// conta quantos caracteres unicode estão codificados nos nbytes que iniciam
+//   em *ptr
+int u8_conta_unichar_sem_verificar(byte *ptr, int nbytes);
+
+// retorna o ponteiro para o primeiro byte do caractere que está n caracteres
+//   adiante do caractere cujo 1o byte está em *ptr, ou para ptr+nbytes se
+//   os nbytes a partir de ptr tiverem só n caracteres
+// não acessa memória fora dos nbytes a partir de ptr
+// quem chama garante que existem pelo menos n caracteres nesses bytes
+byte *u8_avanca_unichar_sem_verificar(byte *ptr, int nbytes, int n);
+
+// retorna o ponteiro para o primeiro byte do caractere que está
+//   n caracteres antes do caractere cujo 1o byte está em *ptr (ptr também
+//   pode apontar para logo após o último caractere de uma região)
+// nbytes é o número de bytes antes de ptr que podem ser acessados; a
+//   região deve conter utf8 válido
+// quem chama garante que existem pelo menos n caracteres nesses bytes
+// recua vários bytes de cada vez, contando os que não são de continuação
+byte *u8_recua_unichar(byte *ptr, int nbytes, int n);
+
 // coloca em buf a codificação utf8 do caractere uni, ou 0xFFFD se uni for inválido
 // retorna o número de bytes usados
 // buf tem que ter espaço suficiente (pode ser necessário colocar até 4 bytes)
 int u8_converte_pra_utf8(unichar uni, byte *buf);
 
+// verificação em partes
+// permite verificar utf8 que chega em partes (lido de um arquivo ou de
+//   um pipe, por exemplo), sem precisar juntar tudo antes
+// um caractere pode começar em uma parte e terminar em outra; os bytes
+//   iniciais dele são guardados no estado até que chegue o restante
+
+// estado de uma verificação em partes
+typedef struct {
+  long long nbytes;   // número de bytes já verificados (até o último caractere completo)
+  long long nchars;   // número de caracteres completos já verificados
+  long long pos_erro; // posição (em bytes desde o início) do caractere com erro, ou -1
+  byte pendente[4];   // bytes iniciais de um caractere que ainda não terminou
+  int npendente;      // quantos bytes tem em pendente
+} u8_verificador_t;
+
+// inicializa o estado em *ver para uma nova verificação
+void u8_verificador_inicia(u8_verificador_t *ver);
+
+// verifica a próxima parte, com nbytes a partir de ptr
+// retorna false se foi encontrado erro (nesta ou em uma parte anterior);
+//   nesse caso, ver->pos_erro tem a posição do início do caractere com erro
+bool u8_verificador_processa(u8_verificador_t *ver, byte *ptr, int nbytes);
+
+// termina a verificação (um caractere incompleto no final é erro)
+// retorna true se todas as partes formam utf8 válido
+bool u8_verificador_termina(u8_verificador_t *ver);
+
+// largura dos caracteres em um terminal
+// em um terminal, cada caractere ocupa 0 colunas (marcas de combinação,
+//   caracteres de controle e de formatação), 2 colunas (ideogramas,
+//   emoji e outros caracteres largos) ou 1 coluna (os demais)
+// a largura vem de uma tabela de dois níveis gerada por gera_tabelas.py
+
+// retorna o número de colunas ocupadas pelo caractere uni
+int u8_largura(unichar uni);
+
+// retorna o número de colunas ocupadas pelos caracteres codificados em utf8
+//   (válido) nos nbytes a partir de ptr
+int u8_largura_bloco(byte *ptr, int nbytes);
+
+// retorna quantos dos caracteres codificados em utf8 (válido) nos nbytes a
+//   partir de ptr cabem, a partir do primeiro, em larg colunas
+int u8_unichar_na_largura(byte *ptr, int nbytes, int larg);
+
+// classes de caracteres, para separar palavras
+// as palavras são sequências de caracteres da mesma classe; uma palavra
+//   "grande" é uma sequência de caracteres que não são espaço
+// a classe vem de uma tabela de dois níveis gerada por gera_tabelas.py
+typedef enum { u8_espaco, u8_palavra, u8_pontuacao, u8_ideograma } u8_classe_t;
+
+// retorna a classe do caractere uni
+//   u8_espaco: espaços, tabulação, finais de linha
+//   u8_palavra: letras, dígitos, marcas de combinação, '_'
+//   u8_pontuacao: pontuação, símbolos e outros caracteres visíveis
+//   u8_ideograma: ideogramas, kana e hangul (escritas sem espaços)
+u8_classe_t u8_classe(unichar uni);
+
+// retorna o ponteiro para o primeiro caractere, a partir do que inicia em
+//   ptr, que não é da mesma classe que esse (ou ptr+nbytes se todos são)
+// se grande for true, a classe é só espaço ou não espaço
+// se pnchars não for NULL, coloca em *pnchars quantos caracteres foram
+//   percorridos
+// os nbytes a partir de ptr devem conter utf8 válido
+byte *u8_avanca_classe(byte *ptr, int nbytes, bool grande, int *pnchars);
+
+// como u8_avanca_classe, mas para trás: retorna o ponteiro para o início da
+//   sequência de caracteres da mesma classe que termina logo antes de ptr
+// nbytes é o número de bytes antes de ptr que podem ser acessados
+byte *u8_recua_classe(byte *ptr, int nbytes, bool grande, int *pnchars);
+
+// conversão entre maiúsculas e minúsculas
+// usa o mapeamento simples do unicode (cada caractere é convertido em um
+//   só caractere, por isso, por exemplo, 'ß' não muda), a partir de tabelas
+//   geradas por gera_tabelas.py
+typedef enum { u8_caixa_alta, u8_caixa_baixa, u8_caixa_alternada } u8_caixa_t;
+
+// retorna o caractere maiúsculo correspondente a uni (ou uni se não houver)
+unichar u8_maiuscula(unichar uni);
+
+// retorna o caractere minúsculo correspondente a uni (ou uni se não houver)
+unichar u8_minuscula(unichar uni);
+
+// retorna uni convertido para a caixa dada (u8_caixa_alternada converte
+//   minúsculas para maiúsculas e maiúsculas para minúsculas)
+unichar u8_altera_caixa(unichar uni, u8_caixa_t caixa);
+
+// converte a caixa dos caracteres nos nbytes a partir de ptr, no próprio
+//   lugar, enquanto a conversão não altera o número de bytes do caractere
+// retorna o número de bytes convertidos (nbytes, se converteu todos); se
+//   for menor, o caractere nessa posição mudaria de tamanho
+// os trechos só com caracteres ASCII são convertidos de 16 em 16
+int u8_altera_caixa_no_lugar(byte *ptr, int nbytes, u8_caixa_t caixa);
+
+// converte a caixa dos caracteres nos nbytes a partir de ptr, colocando o
+//   resultado em buf, que deve ter espaço para nbytes * 3 / 2 bytes (a
+//   conversão pode aumentar o tamanho de um caractere de 2 para 3 bytes)
+// retorna o número de bytes colocados em buf
+int u8_altera_caixa_bloco(byte *ptr, int nbytes, byte *buf, u8_caixa_t caixa);
+
+// normalização NFC (composição canônica)
+// um mesmo texto pode ser representado com caracteres pré-compostos ("ç") ou
+//   decompostos ("c" seguido da cedilha combinante); a normalização NFC
+//   converte para a forma composta, para que textos iguais tenham os
+//   mesmos bytes
+// a verificação rápida usa uma tabela gerada por gera_tabelas.py, e só os
+//   trechos que não passam nela são decompostos e recompostos
+
+// retorna o número de bytes no início dos nbytes em ptr que certamente
+//   estão em NFC e não precisam ser alterados pela normalização do resto
+//   (nbytes se todo o trecho está em NFC)
+// os trechos com caracteres abaixo de U+0300 são verificados de 16 em 16 bytes
+// os nbytes a partir de ptr devem conter utf8 válido
+int u8_prefixo_nfc(byte *ptr, int nbytes);
+
+// coloca em buf a normalização NFC dos nbytes em ptr
+// buf deve ter espaço para 3 * nbytes bytes (a normalização pode triplicar o
+//   tamanho de um caractere)
+// retorna o número de bytes colocados em buf
+// os nbytes a partir de ptr devem conter utf8 válido
+int u8_normaliza_nfc(byte *ptr, int nbytes, byte *buf);
+
+// conversão em bloco, entre utf8 e vetores de unichar
+// os trechos só com caracteres ASCII são convertidos de 16 em 16
+
+// decodifica os caracteres codificados em utf8 nos nbytes a partir de ptr,
+//   colocando seus códigos em unis, que tem espaço para max_unis caracteres
+// para quando acabarem os bytes ou o espaço em unis (um caractere que não
+//   está completo nos nbytes é considerado erro)
+// retorna o número de caracteres colocados em unis ou -1 se encontrar erro
+//   na codificação
+// se pnbytes não for NULL, coloca em *pnbytes o número de bytes decodificados
+//   (ou a posição do erro, em caso de erro)
+int u8_decodifica_bloco(byte *ptr, int nbytes, unichar *unis, int max_unis, int *pnbytes);
+
+// codifica em utf8 os nunis caracteres em unis, colocando o resultado em buf
+// códigos inválidos são codificados como 0xFFFD
+// buf tem que ter espaço suficiente (até 4 bytes por caractere)
+// retorna o número de bytes colocados em buf
+int u8_codifica_bloco(unichar *unis, int nunis, byte *buf);
+
+// conjuntos de caracteres, para buscar qualquer caractere de um conjunto
+// os caracteres ASCII ficam em um mapa de bits, os outros em um vetor
+//   ordenado; quando os caracteres ASCII mais os primeiros bytes dos outros
+//   não passam de 16 bytes distintos, a busca é vetorizada (como strcspn)
+#define U8_CONJ_LOCAIS 8
+typedef struct {
+  unsigned long long ascii[2]; // o bit c%64 de ascii[c/64] indica se c pertence
+  int n_gatilhos;              // número de bytes distintos que iniciam
+  byte gatilhos[16];           //   caracteres do conjunto, se não passar de 16
+  int n_outros;                // número de caracteres não ASCII
+  unichar *outros_alocados;    // os não ASCII, em ordem, se não couberem em
+  unichar outros_locais[U8_CONJ_LOCAIS]; // outros_locais
+} u8_conjunto_t;
+
+// inicializa *conj com os caracteres codificados nos nbytes em ptr
+void u8_conjunto_inicia(u8_conjunto_t *conj, byte *ptr, int nbytes);
+
+// libera a memória que possa ter sido alocada para *conj
+void u8_conjunto_libera(u8_conjunto_t *conj);
+
+// retorna true se uni pertence ao conjunto *conj
+bool u8_conjunto_contem(u8_conjunto_t *conj, unichar uni);
+
+// retorna o ponteiro para o primeiro caractere nos nbytes a partir de ptr
+//   que pertence ao conjunto *conj (se pertence for true) ou que não
+//   pertence (se pertence for false), ou NULL se não houver
+// os nbytes a partir de ptr devem conter utf8 válido
+byte *u8_busca_conjunto(byte *ptr, int nbytes, u8_conjunto_t *conj, bool pertence);
+
+// como u8_busca_conjunto, mas retorna o último caractere nessas condições
+byte *u8_busca_conjunto_r(byte *ptr, int nbytes, u8_conjunto_t *conj, bool pertence);
+
+// transcodificação de arquivos
+// codificações reconhecidas: utf8 (com ou sem marca de ordem de bytes, BOM),
+//   utf16 (little ou big endian) e cp1252 (windows-1252, que inclui latin1)
+typedef enum { u8_utf8, u8_utf8_bom, u8_utf16le, u8_utf16be, u8_cp1252 } u8_codificacao_t;
+
+// detecta a codificação dos nbytes iniciais de um arquivo, em ptr, pela marca
+//   de ordem de bytes (BOM) ou, sem ela, pela quantidade de bytes 0 em
+//   posições pares ou ímpares (utf16)
+// retorna u8_utf8 se não for nenhum desses casos (o arquivo tem caracteres
+//   de 8 bits; se não for utf8 válido, ver u8_parece_utf8)
+u8_codificacao_t u8_detecta_codificacao(byte *ptr, int nbytes);
+
+// retorna true se os nbytes em ptr, que não são utf8 válido, têm mais
+//   caracteres utf8 válidos que bytes inválidos (e devem ser considerados
+//   utf8 com erros, e não cp1252)
+bool u8_parece_utf8(byte *ptr, int nbytes);
+
+// converte os nbytes em ptr, na codificação cod, para utf8, colocando o
+//   resultado em buf, que deve ter espaço para 3 * nbytes bytes
+// a marca de ordem de bytes (BOM) no início é removida; bytes que não podem
+//   ser decodificados são substituídos por 0xFFFD
+// os trechos ASCII são convertidos de 16 em 16 bytes
+// retorna o número de bytes colocados em buf
+int u8_transcodifica(byte *ptr, int nbytes, u8_codificacao_t cod, byte *buf);
+
+// como u8_transcodifica, mas sem remover a marca de ordem de bytes, para
+//   converter um arquivo em partes (a marca só pode estar no início da
+//   primeira)
+// as partes não devem cortar um caractere (nem um par de substitutos utf16)
+int u8_transcodifica_parte(byte *ptr, int nbytes, u8_codificacao_t cod, byte *buf);
+
+// remove, no próprio lugar, os '\r' que precedem '\n' nos nbytes em buf
+//   (converte finais de linha windows para unix)
+// retorna o novo número de bytes
+int u8_tira_cr(byte *buf, int nbytes);
+
+// o contrário de u8_transcodifica: converte os nbytes em utf8 em ptr para a
+//   codificação cod, colocando em buf, que deve ter espaço para 4 * nbytes + 3
+//   bytes
+// coloca a marca de ordem de bytes no início para u8_utf8_bom e utf16;
+//   se poe_cr for true, converte "\n" em "\r\n"; caracteres que não
+//   existem em cp1252 são convertidos para '?'
+// retorna o número de bytes colocados em buf
+int u8_codifica_em(byte *ptr, int nbytes, u8_codificacao_t cod, bool poe_cr, byte *buf);
+
+// como u8_codifica_em, mas sem a marca de ordem de bytes, para converter um
+//   arquivo em partes (a marca só vai antes da primeira)
+// buf deve ter espaço para 4 * nbytes bytes
+int u8_codifica_parte_em(byte *ptr, int nbytes, u8_codificacao_t cod, bool poe_cr, byte *buf);
+
 #endif // _UTF8_H_
 // vim: foldmethod=marker shiftwidth=2